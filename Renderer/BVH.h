@@ -0,0 +1,222 @@
+#pragma once
+
+#include "../Utils/Math.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+struct AABB {
+
+	Math::Vec3<float> lo{ 1e30f, 1e30f, 1e30f };
+	Math::Vec3<float> hi{ -1e30f, -1e30f, -1e30f };
+
+	bool empty() const { return lo.x > hi.x; }
+
+	void expand(const Math::Vec3<float>& p) {
+		lo = { (std::min)(lo.x, p.x), (std::min)(lo.y, p.y), (std::min)(lo.z, p.z) };
+		hi = { (std::max)(hi.x, p.x), (std::max)(hi.y, p.y), (std::max)(hi.z, p.z) };
+	}
+
+	void expand(const AABB& b) {
+		if (b.empty()) return;
+		expand(b.lo);
+		expand(b.hi);
+	}
+
+	Math::Vec3<float> center() const { return { (lo.x + hi.x) * .5f, (lo.y + hi.y) * .5f, (lo.z + hi.z) * .5f }; }
+	Math::Vec3<float> extent() const { return { (hi.x - lo.x) * .5f, (hi.y - lo.y) * .5f, (hi.z - lo.z) * .5f }; }
+
+	float surfaceArea() const {
+		if (empty()) return 0;
+		float x = hi.x - lo.x, y = hi.y - lo.y, z = hi.z - lo.z;
+		return 2.f * (x * y + y * z + z * x);
+	}
+
+	/* Slab test, returns the entry distance or a negative value when missed */
+	float intersect(const Math::Vec3<float>& origin, const Math::Vec3<float>& invDir, float maxT) const {
+		float t0 = 0, t1 = maxT;
+		const float o[3] = { origin.x, origin.y, origin.z };
+		const float inv[3] = { invDir.x, invDir.y, invDir.z };
+		const float l[3] = { lo.x, lo.y, lo.z };
+		const float h[3] = { hi.x, hi.y, hi.z };
+		for (int a = 0; a < 3; a++) {
+			float tNear = (l[a] - o[a]) * inv[a];
+			float tFar = (h[a] - o[a]) * inv[a];
+			if (tNear > tFar) std::swap(tNear, tFar);
+			t0 = (tNear > t0) ? tNear : t0;
+			t1 = (tFar < t1) ? tFar : t1;
+			if (t0 > t1) return -1.f;
+		}
+		return t0;
+	}
+
+};
+
+enum class CULL { OUTSIDE, INTERSECT, INSIDE };
+
+/*
+Bounding volume hierarchy over a list of boxes.
+
+Nodes are stored depth first, the left child always follows its parent and every node
+knows the contiguous range of items below it, so a fully visible subtree is accepted
+without visiting it. Refitting walks the nodes backwards, children before parents.
+*/
+class BVH {
+
+public:
+
+	struct Node {
+		AABB box;
+		uint32_t first, count;	// range in items()
+		uint32_t right;			// second child, 0 for leaves
+		bool leaf() const { return right == 0; }
+	};
+
+	static constexpr uint32_t LEAF_SIZE = 4;
+
+	void build(const std::vector<AABB>& boxes) {
+
+		nodes.clear();
+		itemBoxes = boxes;
+		m_items.resize(boxes.size());
+		for (uint32_t i = 0; i < boxes.size(); i++) m_items[i] = i;
+		if (boxes.empty()) return;
+
+		nodes.reserve(boxes.size() * 2);
+		buildNode(boxes, 0, static_cast<uint32_t>(boxes.size()));
+		builtArea = nodes[0].box.surfaceArea();
+	}
+
+	/* Recomputes every node box from the items, the topology is kept */
+	void refit(const std::vector<AABB>& boxes) {
+		itemBoxes = boxes;
+		for (size_t n = nodes.size(); n-- > 0;) {
+			Node& node = nodes[n];
+			node.box = AABB{};
+			if (node.leaf())
+				for (uint32_t i = node.first; i < node.first + node.count; i++) node.box.expand(boxes[m_items[i]]);
+			else {
+				node.box.expand(nodes[n + 1].box);
+				node.box.expand(nodes[node.right].box);
+			}
+		}
+	}
+
+	/* After many refits the tree gets loose, worth a rebuild once the root grew that much */
+	bool degraded(float factor = 2.f) const {
+		return !nodes.empty() && nodes[0].box.surfaceArea() > builtArea * factor;
+	}
+
+	/* classify(AABB) -> CULL, visit(item) for every item not culled, items of fully inside subtrees are not tested */
+	template<typename Classify, typename Visit>
+	void cull(Classify&& classify, Visit&& visit) const {
+
+		if (nodes.empty()) return;
+
+		uint32_t stack[64];
+		int top = 0;
+		stack[top++] = 0;
+
+		while (top > 0) {
+			const Node& node = nodes[stack[--top]];
+			CULL c = classify(node.box);
+			if (c == CULL::OUTSIDE) continue;
+			if (c == CULL::INSIDE) {
+				for (uint32_t i = node.first; i < node.first + node.count; i++) visit(m_items[i]);
+				continue;
+			}
+			if (node.leaf()) {
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+					if (classify(itemBoxes[m_items[i]]) != CULL::OUTSIDE) visit(m_items[i]);
+				continue;
+			}
+			stack[top++] = node.right;
+			stack[top++] = static_cast<uint32_t>(&node - nodes.data()) + 1;
+		}
+	}
+
+	/* hit(item, maxT) returns the hit distance on the item or a negative value, nearest hit wins */
+	template<typename Hit>
+	int raycast(const Math::Vec3<float>& origin, const Math::Vec3<float>& dir, Hit&& hit, float& t) const {
+
+		int best = -1;
+		t = 1e30f;
+		if (nodes.empty()) return best;
+
+		Math::Vec3<float> invDir = { 1.f / dir.x, 1.f / dir.y, 1.f / dir.z };
+
+		uint32_t stack[64];
+		int top = 0;
+		stack[top++] = 0;
+
+		while (top > 0) {
+			uint32_t index = stack[--top];
+			const Node& node = nodes[index];
+			if (node.box.intersect(origin, invDir, t) < 0) continue;
+
+			if (node.leaf()) {
+				for (uint32_t i = node.first; i < node.first + node.count; i++) {
+					if (itemBoxes[m_items[i]].intersect(origin, invDir, t) < 0) continue;
+					float d = hit(m_items[i], t);
+					if (d >= 0 && d < t) { t = d; best = static_cast<int>(m_items[i]); }
+				}
+				continue;
+			}
+
+			// Visit the closest child first so the farther one is more likely to be skipped
+			uint32_t left = index + 1, right = node.right;
+			float dl = nodes[left].box.intersect(origin, invDir, t);
+			float dr = nodes[right].box.intersect(origin, invDir, t);
+			if (dl >= 0 && dr >= 0 && dr < dl) std::swap(left, right);
+			if (dr >= 0 || dl >= 0) {
+				stack[top++] = right;
+				stack[top++] = left;
+			}
+		}
+		return best;
+	}
+
+	const std::vector<Node>& getNodes() const { return nodes; }
+	const std::vector<uint32_t>& items() const { return m_items; }
+
+private:
+
+	uint32_t buildNode(const std::vector<AABB>& boxes, uint32_t first, uint32_t count) {
+
+		uint32_t index = static_cast<uint32_t>(nodes.size());
+		nodes.push_back({ AABB{}, first, count, 0 });
+
+		AABB box, centers;
+		for (uint32_t i = first; i < first + count; i++) {
+			box.expand(boxes[m_items[i]]);
+			centers.expand(boxes[m_items[i]].center());
+		}
+		nodes[index].box = box;
+
+		if (count <= LEAF_SIZE) return index;
+
+		// Median split on the widest axis of the centers
+		Math::Vec3<float> e = centers.extent();
+		int axis = (e.x > e.y && e.x > e.z) ? 0 : (e.y > e.z) ? 1 : 2;
+		auto key = [&](uint32_t item) {
+			Math::Vec3<float> c = boxes[item].center();
+			return (axis == 0) ? c.x : (axis == 1) ? c.y : c.z;
+		};
+		uint32_t half = count / 2;
+		std::nth_element(m_items.begin() + first, m_items.begin() + first + half, m_items.begin() + first + count,
+			[&](uint32_t a, uint32_t b) { return key(a) < key(b); });
+
+		buildNode(boxes, first, half);
+		uint32_t right = buildNode(boxes, first + half, count - half);
+		nodes[index].right = right;
+		return index;
+	}
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> m_items;
+	std::vector<AABB> itemBoxes;
+	float builtArea = 0;
+
+};
@@ -31,13 +31,22 @@ public:
 	};
 
 	Math::uVec2 toScreenCoords(Math::Vec2<float> p) const  {
-		Math::uVec2 win = { Console::s_WindowSize.w, Console::s_WindowSize.h };
+		Math::Vec2<float> center = getScreenCenter();
 		return {
-		  static_cast<int>(p.u * scaleFactor + win.u * .5f),
-		  static_cast<int>(p.v * scaleFactor + win.v * .5f)
+		  static_cast<int>(p.u * scaleFactor + center.u),
+		  static_cast<int>(p.v * scaleFactor + center.v)
 		};
 	};
 
+	// Inverse of toScreenCoords(toCamCoords(p)), depth is measured along the forward axis
+	Math::Vec3<float> toWorldCoords(Math::uVec2 p, float depth) const {
+		Math::Vec2<float> center = getScreenCenter();
+		float u = (p.u - center.u) / scaleFactor;
+		float v = (p.v - center.v) / scaleFactor;
+		Math::Vec3<float> left = m_left, up = m_up, forward = m_forward, position = m_position;
+		return position + left * u + up * v + forward * depth;
+	};
+
 	void updateCam(float deltaTime ,bool animateCamera=true) {
 		if (animateCamera) {
 			t += deltaTime;
@@ -50,16 +59,34 @@ public:
 		lookAt(m_target);
 	};
 
+	// Moves along the orbit driven by updateCam, in radians
+	void orbit(float angle) { t += angle; }
+
 	void setTarget(Math::Vec3<float> target) { m_target = target; }
+	Math::Vec3<float> getTarget() const { return m_target; }
 
+	// Fixed cameras, call updateCam(0, false) afterwards to look at the target
+	void setPosition(Math::Vec3<float> position) { m_position = position; }
 	Math::Vec3<float> getPosition() const { return m_position; }
 	Math::Vec3<float> getForward() const { return m_forward; }
+	Math::Vec3<float> getLeft() const { return m_left; }
+	Math::Vec3<float> getUp() const { return m_up; }
+	float getScale() const { return scaleFactor; }
 
 	void setScale(float f) { scaleFactor = f; }
 
+	// Cell the camera position projects to, the middle of the window unless set (viewports)
+	Math::Vec2<float> getScreenCenter() const {
+		if (hasScreenCenter) return screenCenter;
+		return { Console::s_WindowSize.w * .5f, Console::s_WindowSize.h * .5f };
+	}
+	void setScreenCenter(Math::Vec2<float> center) { screenCenter = center; hasScreenCenter = true; }
+
 private:
 	float t = 0;
 	float scaleFactor = 50;
+	Math::Vec2<float> screenCenter;
+	bool hasScreenCenter = false;
 	Math::Vec3<float> m_target{ 0, 0, 0 };
 	Math::Vec3<float> m_left{ 0.f, 1.f, 0.f };
 	Math::Vec3<float> m_up{ 0.f, 1.f, 0.f };
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "../Utils/Math.h"
+#include "../Utils/Vertex.h"
+#include "DepthBuffer.h"
+#include "Renderer.h"
+#include "Camera.h"
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+/*
+Deferred shading.
+
+Rasterization only writes depth, an interpolated normal and a material id per cell.
+resolveDeferred() then lights every covered cell exactly once, so the shading cost
+scales with the screen size and not with the overdraw or the triangle count.
+*/
+
+typedef uint8_t MaterialId;
+
+struct Material {
+	COLOR color = COLOR::white;
+	COLOR upColor = COLOR::green; // used when the normal points up, same rule as the forward path
+	float ambient = 0.f;
+	float diffuse = 1.f;
+	float specular = 0.f;
+	float shininess = 16.f;
+};
+
+struct Light {
+	Math::Vec3<float> position{ 7, 9, 5 }; // direction towards the light when directional
+	float intensity = 1.f;
+	bool directional = true;
+	float attenuation = 0.f; // point lights only, intensity / (1 + attenuation * d^2)
+};
+
+class GBuffer {
+
+public:
+
+	// Normals are stored as snorm8, 4 bytes per cell + 4 bytes of depth
+	struct Sample {
+		int8_t nx, ny, nz;
+		uint8_t material; // 0 means nothing was drawn, otherwise MaterialId + 1
+	};
+
+	GBuffer(int w, int h) : width(w), height(h), depth(w, h), samples(w * h) {
+		clear();
+	}
+
+	// depthBuffer owns a raw allocation, a copy would free it twice
+	GBuffer(const GBuffer&) = delete;
+	GBuffer& operator=(const GBuffer&) = delete;
+
+	void clear() {
+		depth.clear();
+		std::fill(samples.begin(), samples.end(), Sample{ 0, 0, 0, 0 });
+	}
+
+	void clear(ScreenRect rect) {
+		rect.x1 = (std::min)(rect.x1, width);
+		rect.y1 = (std::min)(rect.y1, height);
+		depth.clear(rect.x0, rect.y0, rect.x1, rect.y1);
+		for (int y = rect.y0; y < rect.y1; y++)
+			std::fill(samples.begin() + y * width + rect.x0, samples.begin() + y * width + rect.x1, Sample{ 0, 0, 0, 0 });
+	}
+
+	/* Depth tested write, the normal does not need to be normalized */
+	void write(int x, int y, float d, Math::Vec3<float> normal, MaterialId material) {
+		if (!depth.depthTest(x, y, d)) return;
+		samples[y * width + x] = {
+			encode(normal.x), encode(normal.y), encode(normal.z),
+			static_cast<uint8_t>(material + 1)
+		};
+	}
+
+	bool covered(int x, int y) const { return samples[y * width + x].material != 0; }
+	MaterialId materialAt(int x, int y) const { return samples[y * width + x].material - 1; }
+	float depthAt(int x, int y) const { return depth.getAt(x, y); }
+
+	/* For the passes drawn straight into the framebuffer after the resolve, so they stay depth tested */
+	depthBuffer& getDepth() { return depth; }
+
+	Math::Vec3<float> normalAt(int x, int y) const {
+		const Sample& s = samples[y * width + x];
+		Math::Vec3<float> n{ s.nx / 127.f, s.ny / 127.f, s.nz / 127.f };
+		return (n.length() > 0) ? n.normalize() : Math::Vec3<float>{ 0, 1, 0 };
+	}
+
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+
+private:
+
+	static int8_t encode(float v) {
+		v = (v < -1.f) ? -1.f : (v > 1.f) ? 1.f : v;
+		return static_cast<int8_t>(std::lround(v * 127.f));
+	}
+
+	int width, height;
+	depthBuffer depth;
+	std::vector<Sample> samples;
+
+};
+
+/* Geometry pass, same projection as renderTriangles but no lighting at all */
+void renderTrianglesDeferred(GBuffer& gbuffer, const OrthographicCamera& camera,
+	const Vertex* vertices, const Index* indices, size_t indexCount,
+	MaterialId material = 0, ScreenRect clip = {})
+{
+	auto camForward = camera.getForward();
+	auto camPos = camera.getPosition();
+	float camDepth = dot(camPos, camForward);
+
+	clip.x1 = (std::min)(clip.x1, gbuffer.getWidth());
+	clip.y1 = (std::min)(clip.y1, gbuffer.getHeight());
+
+	for (size_t id = 0; id + 2 < indexCount; id += 3) {
+
+		const Vertex& v1 = vertices[indices[id]];
+		const Vertex& v2 = vertices[indices[id + 1]];
+		const Vertex& v3 = vertices[indices[id + 2]];
+
+		Math::uVec2 p1 = camera.toScreenCoords(camera.toCamCoords(v1.position));
+		Math::uVec2 p2 = camera.toScreenCoords(camera.toCamCoords(v2.position));
+		Math::uVec2 p3 = camera.toScreenCoords(camera.toCamCoords(v3.position));
+
+		Math::Vec3<float> depths =
+		{
+			dot(v1.position, camForward) - camDepth,
+			dot(v2.position, camForward) - camDepth,
+			dot(v3.position, camForward) - camDepth,
+		};
+		Math::Vec3<float> n1 = v1.normal, n2 = v2.normal, n3 = v3.normal;
+
+		scanTriangle(p1, p2, p3, [&](int x, int y, Math::Vec3<float> w) {
+			gbuffer.write(x, y, Math::dot(depths, w), n1 * w.x + n2 * w.y + n3 * w.z, material);
+		}, clip);
+	}
+}
+
+void renderMeshDeferred(GBuffer& gbuffer, const OrthographicCamera& camera,
+	const std::vector<Vertex>& vertices, const std::vector<Index>& indices,
+	MaterialId material = 0, ScreenRect clip = {})
+{
+	renderTrianglesDeferred(gbuffer, camera, vertices.data(), indices.data(), indices.size(), material, clip);
+}
+
+/* Lighting pass, per cell Phong over every light then glyph / color mapping */
+void resolveDeferred(char* buffer, const GBuffer& gbuffer, const OrthographicCamera& camera,
+	const std::vector<Light>& lights, const std::vector<Material>& materials,
+	bool hasColors = true, ScreenRect clip = {})
+{
+	Math::Vec3<float> viewDir = camera.getForward() * -1.f;
+
+	bool hasPointLights = std::any_of(lights.begin(), lights.end(), [](const Light& l) { return !l.directional; });
+
+	// Directional lights are the same for every cell
+	std::vector<Math::Vec3<float>> lightDirs;
+	for (const Light& l : lights) {
+		Math::Vec3<float> d = l.position;
+		lightDirs.push_back(l.directional ? d.normalize() : d);
+	}
+
+	clip.x1 = (std::min)(clip.x1, gbuffer.getWidth());
+	clip.y1 = (std::min)(clip.y1, gbuffer.getHeight());
+
+	for (int y = clip.y0; y < clip.y1; y++) {
+		for (int x = clip.x0; x < clip.x1; x++) {
+
+			if (!gbuffer.covered(x, y)) continue;
+
+			const Material& mat = materials[gbuffer.materialAt(x, y)];
+			Math::Vec3<float> n = gbuffer.normalAt(x, y);
+			Math::Vec3<float> worldPos;
+			if (hasPointLights) worldPos = camera.toWorldCoords({ x, y }, gbuffer.depthAt(x, y));
+
+			float intensity = mat.ambient;
+			for (size_t i = 0; i < lights.size(); i++) {
+
+				const Light& light = lights[i];
+				Math::Vec3<float> l = lightDirs[i];
+				float strength = light.intensity;
+
+				if (!light.directional) {
+					l = l - worldPos;
+					float dist = l.length();
+					if (dist == 0) continue;
+					l = l * (1.f / dist);
+					strength /= 1.f + light.attenuation * dist * dist;
+				}
+
+				float nDotL = Math::dot(n, l);
+				if (nDotL <= 0) continue;
+
+				intensity += mat.diffuse * nDotL * strength;
+
+				if (mat.specular > 0) {
+					Math::Vec3<float> r = n * (2.f * nDotL) - l;
+					float rDotV = Math::dot(r, viewDir);
+					if (rDotV > 0) intensity += mat.specular * std::pow(rDotV, mat.shininess) * strength;
+				}
+			}
+
+			intensity = (intensity < 0.f) ? 0.f : (intensity > 1.f) ? 1.f : intensity;
+			char character = table[9 - int(intensity * 9)];
+
+			if (hasColors) {
+				COLOR color = (Math::dot(n, { 0,1,0 }) > 0.75f) ? mat.upColor : mat.color;
+				writeColoredCell(buffer, SCREEN_WIDTH, x, y, character, color);
+			}
+			else {
+				setPixelChar(buffer, SCREEN_WIDTH, x, y, character);
+			}
+		}
+	}
+}
@@ -21,7 +21,7 @@ public:
 		buff[y * width + x] = v;
 	}
 
-	float getAt(int x, int y) {
+	float getAt(int x, int y) const {
 		assert(y * width + x < size);
 		return buff[y * width + x];
 	}
@@ -43,6 +43,12 @@ public:
 
 	}
 
+	/* Clears [x0,x1[ x [y0,y1[ only */
+	void clear(int x0, int y0, int x1, int y1) {
+		for (int y = y0; y < y1; y++)
+			std::fill(buff + y * width + x0, buff + y * width + x1, 1000.f);
+	}
+
 	depthBuffer(int w, int h) : width(w), height(h) { 
 		size = width * height;
 		buff = new float[size];
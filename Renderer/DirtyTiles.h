@@ -0,0 +1,194 @@
+#pragma once
+
+#include "../Utils/Math.h"
+#include "Renderer.h"
+#include "Camera.h"
+#include "Scene.h"
+
+#include <vector>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+/*
+Incremental rendering.
+
+DirtyTiles remembers what the last frame was drawn with: the camera, the frame settings and,
+per scene object, its version and the screen rectangle it covered. update() compares the
+current state against it:
+ - nothing changed: the previous frame is still valid, nothing has to be drawn or presented
+ - only some objects changed: the tiles under their old and new rectangles are dirty
+ - the camera, the window or the settings changed: everything is dirty
+forEachDirtyRect() then hands the dirty tiles merged into rectangles, the caller clears and
+re-rasterizes each one with it as the clip.
+*/
+
+/* Everything outside the scene and the camera that changes the picture */
+struct FrameSettings {
+	RENDER_MODE mode = RENDER_MODE::FILLED;
+	bool deferred = true;
+	bool hasColors = true;
+	uint32_t revision = 0; // bump it after editing lights or materials
+
+	bool operator==(const FrameSettings&) const = default;
+};
+
+class DirtyTiles {
+
+public:
+
+	static constexpr int TILE_SIZE = 16;
+	static constexpr int TILES_X = (SCREEN_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+	static constexpr int TILES_Y = (SCREEN_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+
+	DirtyTiles() { tiles.fill(true); }
+
+	/* Forces a full redraw on the next update */
+	void invalidate() { full = true; }
+
+	/* True when something has to be redrawn */
+	bool update(const OrthographicCamera& camera, const Scene& scene, const FrameSettings& settings) {
+
+		tiles.fill(false);
+		m_dirtyCount = 0;
+
+		View view = View::of(camera);
+		if (full || !(view == lastView) || !(settings == lastSettings) || scene.size() < drawn.size()) {
+			full = false;
+			lastView = view;
+			lastSettings = settings;
+			drawn.clear();
+			for (ObjectId id = 0; id < scene.size(); id++)
+				drawn.push_back({ scene.get(id).version, screenBounds(camera, scene.get(id).bounds) });
+			tiles.fill(true);
+			m_dirtyCount = TILES_X * TILES_Y;
+			return true;
+		}
+
+		for (ObjectId id = 0; id < scene.size(); id++) {
+			const Scene::Object& o = scene.get(id);
+			if (id < drawn.size() && drawn[id].version == o.version) continue;
+
+			ScreenRect now = screenBounds(camera, o.bounds);
+			if (id < drawn.size()) mark(drawn[id].rect);
+			else drawn.push_back({});
+			mark(now);
+			drawn[id] = { o.version, now };
+		}
+		return m_dirtyCount > 0;
+	}
+
+	/* draw(rect) for the dirty tiles, consecutive tiles of a row and identical spans of consecutive rows are merged */
+	template<typename Draw>
+	void forEachDirtyRect(Draw&& draw) const {
+
+		std::vector<ScreenRect> rects;
+
+		for (int ty = 0; ty < TILES_Y; ty++) {
+			for (int tx = 0; tx < TILES_X;) {
+				if (!tiles[ty * TILES_X + tx]) { tx++; continue; }
+				int end = tx;
+				while (end < TILES_X && tiles[ty * TILES_X + end]) end++;
+
+				// Extend the rect ending right above with the same span, if any
+				ScreenRect span = tileRect(tx, ty, end, ty + 1);
+				bool merged = false;
+				for (ScreenRect& r : rects) {
+					if (r.x0 == span.x0 && r.x1 == span.x1 && r.y1 == span.y0) {
+						r.y1 = span.y1;
+						merged = true;
+						break;
+					}
+				}
+				if (!merged) rects.push_back(span);
+				tx = end;
+			}
+		}
+
+		for (const ScreenRect& r : rects) draw(r);
+	}
+
+	int dirtyCount() const { return m_dirtyCount; }
+
+	/* Cells covered by a world box, one cell of margin for the rasterizer rounding */
+	static ScreenRect screenBounds(const OrthographicCamera& camera, const AABB& box) {
+
+		if (box.empty()) return { 0, 0, 0, 0 };
+
+		Math::Vec3<float> position = camera.getPosition(), left = camera.getLeft(), up = camera.getUp();
+		float scale = camera.getScale();
+		Math::Vec2<float> center = camera.getScreenCenter();
+
+		float uMin = 1e30f, uMax = -1e30f, vMin = 1e30f, vMax = -1e30f;
+		for (int corner = 0; corner < 8; corner++) {
+			Math::Vec3<float> p = {
+				((corner & 1) ? box.hi.x : box.lo.x) - position.x,
+				((corner & 2) ? box.hi.y : box.lo.y) - position.y,
+				((corner & 4) ? box.hi.z : box.lo.z) - position.z
+			};
+			float u = Math::dot(p, left) * scale + center.u, v = Math::dot(p, up) * scale + center.v;
+			uMin = (std::min)(uMin, u); uMax = (std::max)(uMax, u);
+			vMin = (std::min)(vMin, v); vMax = (std::max)(vMax, v);
+		}
+
+		auto cell = [](float f, int lo, int hi) {
+			f = (f < lo) ? lo : (f > hi) ? hi : f;
+			return static_cast<int>(std::floor(f));
+		};
+		return {
+			cell(uMin - 1.f, 0, SCREEN_WIDTH), cell(vMin - 1.f, 0, SCREEN_HEIGHT),
+			cell(uMax + 2.f, 0, SCREEN_WIDTH), cell(vMax + 2.f, 0, SCREEN_HEIGHT)
+		};
+	}
+
+private:
+
+	/* Camera state that changes the projection, compared exactly */
+	struct View {
+		Math::Vec3<float> position, forward, up;
+		float scale = 0;
+		Math::Vec2<float> center;
+
+		static View of(const OrthographicCamera& camera) {
+			return { camera.getPosition(), camera.getForward(), camera.getUp(), camera.getScale(), camera.getScreenCenter() };
+		}
+
+		bool operator==(const View& o) const {
+			return position.x == o.position.x && position.y == o.position.y && position.z == o.position.z
+				&& forward.x == o.forward.x && forward.y == o.forward.y && forward.z == o.forward.z
+				&& up.x == o.up.x && up.y == o.up.y && up.z == o.up.z
+				&& scale == o.scale && center.u == o.center.u && center.v == o.center.v;
+		}
+	};
+
+	struct Drawn {
+		uint32_t version = 0;
+		ScreenRect rect = { 0, 0, 0, 0 };
+	};
+
+	void mark(const ScreenRect& r) {
+		if (r.x0 >= r.x1 || r.y0 >= r.y1) return;
+		for (int ty = r.y0 / TILE_SIZE; ty <= (r.y1 - 1) / TILE_SIZE; ty++)
+			for (int tx = r.x0 / TILE_SIZE; tx <= (r.x1 - 1) / TILE_SIZE; tx++) {
+				bool& t = tiles[ty * TILES_X + tx];
+				if (!t) m_dirtyCount++;
+				t = true;
+			}
+	}
+
+	static ScreenRect tileRect(int tx0, int ty0, int tx1, int ty1) {
+		return {
+			tx0 * TILE_SIZE, ty0 * TILE_SIZE,
+			(std::min)(tx1 * TILE_SIZE, SCREEN_WIDTH), (std::min)(ty1 * TILE_SIZE, SCREEN_HEIGHT)
+		};
+	}
+
+	std::array<bool, TILES_X * TILES_Y> tiles;
+	int m_dirtyCount = 0;
+	bool full = true;
+
+	View lastView;
+	FrameSettings lastSettings;
+	std::vector<Drawn> drawn;
+
+};
@@ -0,0 +1,412 @@
+#pragma once
+
+// Winsock 2 has to be seen before Windows.h, which otherwise pulls the old winsock.h
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <Windows.h>
+
+#pragma comment(lib, "Ws2_32.lib")
+
+#include "Renderer.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+
+/*
+Frame fan-out server, one render process and any number of terminal viewers.
+
+Each frame is encoded once on the render thread, either as a keyframe (cursor home + the
+whole framebuffer) or as a delta (cursor positioned runs of the cells that changed), into
+an immutable reference counted Frame. A network thread shares the same Frame with every
+client and writes it with non-blocking sends, driven by WSAPoll.
+
+Clients never buffer without bound: a keyframe makes everything queued before it useless
+so it replaces the backlog, and a client whose backlog still grows past maxPendingBytes
+drops it and waits for the next keyframe. New clients start from the current keyframe
+and the deltas since.
+
+Any ANSI terminal of the framebuffer size can watch, e.g. `nc host 7777` or telnet.
+*/
+
+struct Frame {
+	std::string bytes;
+	bool keyframe = false;
+	uint64_t sequence = 0;
+};
+
+typedef std::shared_ptr<const Frame> FramePtr;
+
+class FrameEncoder {
+
+public:
+
+	explicit FrameEncoder(int keyframeInterval = 60) : keyframeInterval(keyframeInterval) {}
+
+	/* Encodes against the previous frame, empty deltas come back as nullptr */
+	FramePtr encode(const char* buffer, size_t size, bool hasColors) {
+
+		const int cellBytes = hasColors ? 8 : 1;
+		const int rowBytes = SCREEN_WIDTH * cellBytes;
+		const int rows = static_cast<int>(size / rowBytes);
+
+		bool keyframe = forceKeyframe || previous.size() != size || cellBytes != previousCellBytes || sinceKeyframe >= keyframeInterval;
+
+		std::shared_ptr<Frame> frame = std::make_shared<Frame>();
+		std::string& out = frame->bytes;
+
+		if (!keyframe) {
+
+			// An unchanged gap shorter than a cursor move is cheaper to resend
+			const int maxGap = (CURSOR_MOVE_BYTES + cellBytes - 1) / cellBytes;
+			const char* old = previous.data();
+
+			for (int y = 0; y < rows; y++) {
+
+				const char* row = buffer + y * rowBytes;
+				const char* oldRow = old + y * rowBytes;
+				auto changed = [&](int x) { return std::memcmp(row + x * cellBytes, oldRow + x * cellBytes, cellBytes) != 0; };
+
+				for (int x = 0; x < SCREEN_WIDTH; x++) {
+					if (!changed(x)) continue;
+					int end = x + 1;
+					for (int i = end; i < SCREEN_WIDTH && i - end < maxGap; i++)
+						if (changed(i)) end = i + 1;
+					out += "\033[" + std::to_string(y + 1) + ';' + std::to_string(x + 1) + 'H';
+					out.append(row + x * cellBytes, (end - x) * cellBytes);
+					x = end - 1;
+				}
+			}
+
+			if (out.size() >= size) keyframe = true;
+			else if (out.empty()) {
+				sinceKeyframe++;
+				return nullptr;
+			}
+		}
+
+		if (keyframe) {
+			// Reset attributes and hide the cursor too, a viewer may join on any keyframe
+			out.assign("\033[0m\033[?25l\033[H");
+			out.append(buffer, size);
+			sinceKeyframe = 0;
+			forceKeyframe = false;
+		}
+		else sinceKeyframe++;
+
+		frame->keyframe = keyframe;
+		frame->sequence = sequence++;
+		previous.assign(buffer, buffer + size);
+		previousCellBytes = cellBytes;
+		return frame;
+	}
+
+	/* The next frame will be a keyframe */
+	void reset() { forceKeyframe = true; }
+
+private:
+
+	static constexpr int CURSOR_MOVE_BYTES = 10; // ESC[yyy;xxxH
+
+	int keyframeInterval;
+	int sinceKeyframe = 0;
+	bool forceKeyframe = true;
+	uint64_t sequence = 0;
+	std::vector<char> previous;
+	int previousCellBytes = 0;
+
+};
+
+struct FrameServerSettings {
+	uint16_t port = 7777;
+	bool loopbackOnly = false;
+	size_t maxPendingBytes = 1 << 20;	// per client, past that it skips to the next keyframe
+	int keyframeInterval = 60;			// frames, also bounds what a new client has to catch up
+};
+
+class FrameServer {
+
+public:
+
+	explicit FrameServer(const FrameServerSettings& settings = {}) : settings(settings), encoder(settings.keyframeInterval) {}
+	~FrameServer() { stop(); }
+
+	FrameServer(const FrameServer&) = delete;
+	FrameServer& operator=(const FrameServer&) = delete;
+
+	bool start() {
+
+		if (running) return true;
+
+		WSADATA wsa;
+		if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return false;
+
+		listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(settings.port);
+		address.sin_addr.s_addr = htonl(settings.loopbackOnly ? INADDR_LOOPBACK : INADDR_ANY);
+
+		int yes = 1;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&yes), sizeof(yes));
+
+		if (listener == INVALID_SOCKET
+			|| bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR
+			|| listen(listener, SOMAXCONN) == SOCKET_ERROR
+			|| !nonBlocking(listener)
+			|| !openWakeSocket())
+		{
+			closeSockets();
+			WSACleanup();
+			return false;
+		}
+
+		running = true;
+		network = std::thread([this]() { eventLoop(); });
+		return true;
+	}
+
+	void stop() {
+
+		if (!running) return;
+
+		running = false;
+		wake();
+		network.join();
+
+		for (Client& c : clients) closesocket(c.socket);
+		clients.clear();
+		gop.clear();
+		closeSockets();
+		WSACleanup();
+	}
+
+	/* Called once per presented frame from the render thread, the cost does not depend on the viewer count */
+	void publish(const char* buffer, size_t size, bool hasColors = true) {
+
+		if (!running) return;
+
+		// Nobody watching: skip the encoding, the first viewer gets a keyframe anyway
+		if (m_clientCount.load(std::memory_order_relaxed) == 0 && !acceptPending.load(std::memory_order_relaxed)) {
+			encoder.reset();
+			return;
+		}
+		if (keyframeRequested.exchange(false)) encoder.reset();
+
+		FramePtr frame = encoder.encode(buffer, size, hasColors);
+		if (!frame) return;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			published.push_back(std::move(frame));
+		}
+		wake();
+	}
+
+	size_t clientCount() const { return m_clientCount.load(std::memory_order_relaxed); }
+
+	/* Frames skipped by slow clients to catch up on a keyframe */
+	unsigned int skippedFrames() const { return m_skipped.load(std::memory_order_relaxed); }
+
+private:
+
+	struct Client {
+		SOCKET socket;
+		std::deque<FramePtr> queue;
+		size_t offset = 0;			// bytes of queue.front() already sent
+		size_t pending = 0;			// bytes left over the whole queue
+		bool waitingKeyframe = false;
+	};
+
+	void eventLoop() {
+
+		std::vector<WSAPOLLFD> fds;
+		std::vector<FramePtr> frames;
+
+		while (running) {
+
+			fds.clear();
+			fds.push_back({ listener, POLLRDNORM, 0 });
+			fds.push_back({ wakeSocket, POLLRDNORM, 0 });
+			for (const Client& c : clients)
+				fds.push_back({ c.socket, static_cast<short>(c.queue.empty() ? POLLRDNORM : POLLRDNORM | POLLWRNORM), 0 });
+
+			if (WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), 100) == SOCKET_ERROR) continue;
+
+			if (fds[1].revents & POLLRDNORM) {
+				char drain[64];
+				while (recv(wakeSocket, drain, sizeof(drain), 0) > 0);
+			}
+
+			// Clients first, fds[] indices would not match once new ones are accepted
+			for (size_t i = clients.size(); i-- > 0;) {
+				short events = fds[i + 2].revents;
+				bool alive = !(events & (POLLERR | POLLHUP | POLLNVAL));
+				if (alive && (events & POLLRDNORM)) alive = discardInput(clients[i]);
+				if (alive && (events & POLLWRNORM)) alive = flush(clients[i]);
+				if (!alive) drop(i);
+			}
+			if (clients.empty()) gop.clear(); // publish() stops encoding, the next viewer waits for a fresh keyframe
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				frames.swap(published);
+			}
+			for (FramePtr& frame : frames) {
+				if (frame->keyframe) gop.clear();
+				if (frame->keyframe || !gop.empty()) gop.push_back(frame); // a gop always starts on a keyframe
+				for (Client& c : clients) deliver(c, frame);
+			}
+			frames.clear();
+
+			if (fds[0].revents & POLLRDNORM) acceptClients();
+
+			for (size_t i = clients.size(); i-- > 0;)
+				if (!clients[i].queue.empty() && !flush(clients[i])) drop(i);
+
+			m_clientCount.store(clients.size(), std::memory_order_relaxed);
+		}
+	}
+
+	void acceptClients() {
+
+		while (true) {
+			SOCKET s = accept(listener, nullptr, nullptr);
+			if (s == INVALID_SOCKET) return;
+
+			int yes = 1;
+			setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&yes), sizeof(yes));
+			if (!nonBlocking(s)) { closesocket(s); continue; }
+
+			Client c;
+			c.socket = s;
+			if (!gop.empty()) for (const FramePtr& frame : gop) deliver(c, frame);
+			else {
+				// No keyframe to start from, the render thread sends one on the next publish
+				c.waitingKeyframe = true;
+				acceptPending = true;
+				keyframeRequested = true;
+			}
+			clients.push_back(std::move(c));
+		}
+	}
+
+	void deliver(Client& c, const FramePtr& frame) {
+
+		if (frame->keyframe) {
+			// Everything not started yet is superseded
+			dropBacklog(c);
+			c.waitingKeyframe = false;
+			acceptPending = false;
+		}
+		else if (c.waitingKeyframe) {
+			m_skipped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		c.queue.push_back(frame);
+		c.pending += frame->bytes.size();
+
+		if (c.pending > settings.maxPendingBytes && !frame->keyframe) {
+			m_skipped.fetch_add(static_cast<unsigned int>(dropBacklog(c)), std::memory_order_relaxed);
+			c.waitingKeyframe = true;
+		}
+	}
+
+	/* Keeps only the frame being sent, a half written escape sequence would garble the stream */
+	size_t dropBacklog(Client& c) {
+		size_t keep = (c.offset > 0) ? 1 : 0;
+		size_t dropped = c.queue.size() - keep;
+		c.queue.erase(c.queue.begin() + keep, c.queue.end());
+		c.pending = keep ? c.queue.front()->bytes.size() - c.offset : 0;
+		return dropped;
+	}
+
+	/* Sends until the socket would block, false once the client is gone */
+	bool flush(Client& c) {
+
+		while (!c.queue.empty()) {
+			const std::string& bytes = c.queue.front()->bytes;
+			int sent = send(c.socket, bytes.data() + c.offset, static_cast<int>(bytes.size() - c.offset), 0);
+			if (sent == SOCKET_ERROR) return WSAGetLastError() == WSAEWOULDBLOCK;
+			c.offset += sent;
+			c.pending -= sent;
+			if (c.offset == bytes.size()) {
+				c.queue.pop_front();
+				c.offset = 0;
+			}
+		}
+		return true;
+	}
+
+	/* Viewers have nothing to say, read and ignore, false on disconnect */
+	bool discardInput(Client& c) {
+		char drain[256];
+		int received = recv(c.socket, drain, sizeof(drain), 0);
+		if (received == 0) return false;
+		return received > 0 || WSAGetLastError() == WSAEWOULDBLOCK;
+	}
+
+	void drop(size_t i) {
+		closesocket(clients[i].socket);
+		clients[i] = std::move(clients.back());
+		clients.pop_back();
+	}
+
+	static bool nonBlocking(SOCKET s) {
+		u_long yes = 1;
+		return ioctlsocket(s, FIONBIO, &yes) == 0;
+	}
+
+	/* Loopback UDP socket connected to itself, publish() sends a byte to end the WSAPoll wait */
+	bool openWakeSocket() {
+		wakeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (wakeSocket == INVALID_SOCKET) return false;
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		int length = sizeof(address);
+		return bind(wakeSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != SOCKET_ERROR
+			&& getsockname(wakeSocket, reinterpret_cast<sockaddr*>(&address), &length) != SOCKET_ERROR
+			&& connect(wakeSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != SOCKET_ERROR
+			&& nonBlocking(wakeSocket);
+	}
+
+	void wake() {
+		char b = 0;
+		send(wakeSocket, &b, 1, 0);
+	}
+
+	void closeSockets() {
+		if (listener != INVALID_SOCKET) closesocket(listener);
+		if (wakeSocket != INVALID_SOCKET) closesocket(wakeSocket);
+		listener = wakeSocket = INVALID_SOCKET;
+	}
+
+	FrameServerSettings settings;
+	FrameEncoder encoder;		// render thread only
+
+	SOCKET listener = INVALID_SOCKET;
+	SOCKET wakeSocket = INVALID_SOCKET;
+	std::thread network;
+	std::atomic<bool> running{ false };
+
+	std::mutex mutex;
+	std::vector<FramePtr> published;	// render thread -> network thread
+
+	// Network thread only
+	std::vector<Client> clients;
+	std::vector<FramePtr> gop;			// latest keyframe and the deltas since
+
+	std::atomic<size_t> m_clientCount{ 0 };
+	std::atomic<bool> acceptPending{ false };
+	std::atomic<bool> keyframeRequested{ false };	// a viewer joined with no gop to replay
+	std::atomic<unsigned int> m_skipped{ 0 };
+
+};
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <Windows.h>
+
+#include "../Utils/SPSCQueue.h"
+#include "../Utils/FPSCounter.h"
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+/*
+Asynchronous terminal input.
+
+A dedicated thread puts the console in virtual terminal input mode, so keys and xterm
+(SGR 1006) mouse reports arrive as escape sequences, decodes them and pushes timestamped
+events in a lock-free queue. The frame loop drains it with poll(), which never blocks.
+
+Input-to-present latency: hand every event you act upon to InputLatency::consumed(), then
+call presented() right after the frame went out.
+*/
+
+enum class INPUT_EVENT { KEY, MOUSE_DOWN, MOUSE_UP, MOUSE_MOVE, WHEEL };
+
+/* Printable keys are their ASCII code, the others start past the byte range */
+namespace KEY {
+	enum : int {
+		ESCAPE = 27, ENTER = 13, TAB = 9, BACKSPACE = 127,
+		UP = 256, DOWN, RIGHT, LEFT, HOME, END, INSERT, DEL, PAGE_UP, PAGE_DOWN
+	};
+}
+
+struct InputEvent {
+	INPUT_EVENT type = INPUT_EVENT::KEY;
+	int key = 0;				// KEY: key code
+	int x = 0, y = 0;			// mouse: cell, 0 based
+	int button = 0;				// mouse: 0 left, 1 middle, 2 right, 3 none (moves), WHEEL: 1 up, -1 down
+	long long timestamp = 0;	// nanoTime() when read from the console
+};
+
+/*
+Byte at a time escape sequence decoder.
+A lone ESC is ambiguous until the next byte, flush() settles it once a read batch is over.
+Sequences longer than params[] are dropped.
+*/
+class InputDecoder {
+
+public:
+
+	template<typename Emit>
+	void feed(char c, long long timestamp, Emit&& emit) {
+
+		unsigned char b = static_cast<unsigned char>(c);
+
+		switch (state) {
+
+		case STATE::GROUND:
+			if (b == 27) { state = STATE::ESCAPE; return; }
+			emit(key(b == 8 ? static_cast<int>(KEY::BACKSPACE) : b, timestamp));
+			return;
+
+		case STATE::ESCAPE:
+			if (b == '[') { state = STATE::CSI; length = 0; return; }
+			if (b == 'O') { state = STATE::SS3; return; }
+			// Alt + key, or ESC pressed twice: report the escape and restart on this byte
+			state = STATE::GROUND;
+			emit(key(KEY::ESCAPE, timestamp));
+			feed(c, timestamp, emit);
+			return;
+
+		case STATE::SS3:
+			state = STATE::GROUND;
+			if (int k = finalKey(b)) emit(key(k, timestamp));
+			return;
+
+		case STATE::CSI:
+			// Parameters and intermediates until a final byte in [0x40, 0x7E]
+			if (b < 0x40 || b > 0x7E) {
+				if (length < sizeof(params)) params[length++] = c;
+				else state = STATE::GROUND; // malformed, drop it
+				return;
+			}
+			state = STATE::GROUND;
+			decodeCSI(b, timestamp, emit);
+			return;
+		}
+	}
+
+	template<typename Emit>
+	void flush(long long timestamp, Emit&& emit) {
+		if (state != STATE::ESCAPE) return; // a sequence split over two reads carries on
+		emit(key(KEY::ESCAPE, timestamp));
+		state = STATE::GROUND;
+	}
+
+private:
+
+	enum class STATE { GROUND, ESCAPE, CSI, SS3 };
+
+	static InputEvent key(int code, long long timestamp) {
+		InputEvent e;
+		e.type = INPUT_EVENT::KEY;
+		e.key = code;
+		e.timestamp = timestamp;
+		return e;
+	}
+
+	static int finalKey(unsigned char b) {
+		switch (b) {
+		case 'A': return KEY::UP;
+		case 'B': return KEY::DOWN;
+		case 'C': return KEY::RIGHT;
+		case 'D': return KEY::LEFT;
+		case 'H': return KEY::HOME;
+		case 'F': return KEY::END;
+		}
+		return 0;
+	}
+
+	/* Reads up to 3 ';' separated numbers after an optional prefix char, returns how many */
+	int numbers(int* out, int capacity) const {
+		int count = 0, value = 0;
+		bool digits = false;
+		for (size_t i = (length > 0 && params[0] == '<') ? 1 : 0; i < length; i++) {
+			char c = params[i];
+			if (c >= '0' && c <= '9') { value = value * 10 + (c - '0'); digits = true; }
+			else if (c == ';') { if (count < capacity) out[count++] = value; value = 0; digits = false; }
+			else return 0;
+		}
+		if (digits && count < capacity) out[count++] = value;
+		return count;
+	}
+
+	template<typename Emit>
+	void decodeCSI(unsigned char last, long long timestamp, Emit&& emit) {
+
+		int n[3] = { 0, 0, 0 };
+		int count = numbers(n, 3);
+
+		// SGR mouse report: ESC [ < button ; x ; y (M press / m release)
+		if (length > 0 && params[0] == '<') {
+			if (count != 3 || (last != 'M' && last != 'm')) return;
+			InputEvent e;
+			e.x = n[1] - 1;
+			e.y = n[2] - 1;
+			e.timestamp = timestamp;
+			int b = n[0];
+			if (b & 64) {
+				e.type = INPUT_EVENT::WHEEL;
+				e.button = (b & 1) ? -1 : 1;
+			}
+			else {
+				e.button = b & 3;
+				e.type = (b & 32) ? INPUT_EVENT::MOUSE_MOVE : (last == 'M') ? INPUT_EVENT::MOUSE_DOWN : INPUT_EVENT::MOUSE_UP;
+			}
+			emit(e);
+			return;
+		}
+
+		// ESC [ number ~ for the editing keys
+		if (last == '~') {
+			static const int tilde[] = { 0, KEY::HOME, KEY::INSERT, KEY::DEL, KEY::END, KEY::PAGE_UP, KEY::PAGE_DOWN, KEY::HOME, KEY::END };
+			if (count >= 1 && n[0] > 0 && n[0] < 9) emit(key(tilde[n[0]], timestamp));
+			return;
+		}
+
+		// Arrows, possibly with modifiers (ESC [ 1 ; 5 A), the modifiers are ignored
+		if (int k = finalKey(last)) emit(key(k, timestamp));
+	}
+
+	STATE state = STATE::GROUND;
+	char params[16];
+	size_t length = 0;
+
+};
+
+class InputThread {
+
+public:
+
+	static constexpr size_t QUEUE_SIZE = 256;
+
+	InputThread() = default;
+	~InputThread() { stop(); }
+
+	InputThread(const InputThread&) = delete;
+	InputThread& operator=(const InputThread&) = delete;
+
+	void start() {
+
+		if (running) return;
+
+		hIn = GetStdHandle(STD_INPUT_HANDLE);
+		GetConsoleMode(hIn, &previousMode);
+
+		// Raw VT input: no line buffering or echo, and no quick edit stealing the mouse
+		DWORD mode = ENABLE_VIRTUAL_TERMINAL_INPUT | ENABLE_EXTENDED_FLAGS | ENABLE_WINDOW_INPUT;
+		SetConsoleMode(hIn, mode);
+
+		// Press / release and drag reports in the SGR encoding
+		std::cout << "\033[?1000h\033[?1002h\033[?1006h";
+		std::cout.flush();
+
+		running = true;
+		reader = std::thread([this]() { readLoop(); });
+	}
+
+	void stop() {
+
+		if (!running) return;
+
+		running = false;
+		reader.join();
+
+		std::cout << "\033[?1006l\033[?1002l\033[?1000l";
+		std::cout.flush();
+		SetConsoleMode(hIn, previousMode);
+	}
+
+	/* Never blocks, false when no event is pending */
+	bool poll(InputEvent& e) { return queue.pop(e); }
+
+	/* Events lost because the frame loop did not drain the queue in time */
+	unsigned int dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+
+	void readLoop() {
+
+		INPUT_RECORD records[64];
+		auto emit = [this](const InputEvent& e) {
+			if (!queue.push(e)) m_dropped.fetch_add(1, std::memory_order_relaxed);
+		};
+
+		while (running) {
+
+			// Timed wait so stop() is noticed even without any input
+			if (WaitForSingleObject(hIn, 10) != WAIT_OBJECT_0) continue;
+
+			DWORD count = 0;
+			if (!ReadConsoleInputA(hIn, records, 64, &count)) continue;
+			long long now = nanoTime();
+
+			for (DWORD r = 0; r < count; r++) {
+				if (records[r].EventType != KEY_EVENT) continue;
+				const KEY_EVENT_RECORD& k = records[r].Event.KeyEvent;
+				if (!k.bKeyDown || k.uChar.AsciiChar == 0) continue;
+				WORD repeats = (k.wRepeatCount > 0) ? k.wRepeatCount : 1;
+				for (WORD repeat = 0; repeat < repeats; repeat++)
+					decoder.feed(k.uChar.AsciiChar, now, emit);
+			}
+
+			// Escape sequences arrive whole in a batch, an ESC left hanging is the key itself
+			decoder.flush(now, emit);
+		}
+	}
+
+	HANDLE hIn = nullptr;
+	DWORD previousMode = 0;
+
+	std::thread reader;
+	std::atomic<bool> running{ false };
+	std::atomic<unsigned int> m_dropped{ 0 };
+
+	InputDecoder decoder;
+	SPSCQueue<InputEvent, QUEUE_SIZE> queue;
+
+};
+
+/* Time from reading an event to presenting the first frame that reacted to it, in milliseconds */
+struct InputLatency {
+
+	double lastMs = 0, averageMs = 0, maxMs = 0;
+	unsigned int samples = 0;
+
+	/* Keeps the oldest event of the frame, it waited the longest */
+	void consumed(const InputEvent& e) {
+		if (pending == 0 || e.timestamp < pending) pending = e.timestamp;
+	}
+
+	void presented(long long now = nanoTime()) {
+		if (pending == 0) return;
+		lastMs = (now - pending) / 1E6;
+		pending = 0;
+		samples++;
+		// Running mean over the first frames, then an exponential moving average
+		double weight = (std::max)(1.0 / samples, 0.05);
+		averageMs += (lastMs - averageMs) * weight;
+		maxMs = (std::max)(maxMs, lastMs);
+	}
+
+	/* The events of this frame changed nothing on screen, they are not measured */
+	void skip() { pending = 0; }
+
+	void resetMax() { maxMs = 0; }
+
+private:
+	long long pending = 0;
+
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "../Utils/Math.h"
+#include "../Utils/Vertex.h"
+#include "../Utils/Simplify.h"
+#include "Camera.h"
+
+#include <vector>
+#include <cmath>
+
+/*
+Level of detail chains built with the quadric simplifier.
+
+At terminal resolution most triangles of a detailed mesh are smaller than a cell, so the
+renderer picks the coarsest level whose geometric error still projects below a fraction
+of a cell. With the orthographic camera the projected size only depends on the scale.
+*/
+
+struct LODLevel {
+	std::vector<Vertex> vertices;
+	std::vector<Index> indices;
+	float error = 0; // world units, accumulated from level 0
+};
+
+struct LODChain {
+
+	std::vector<LODLevel> levels; // levels[0] is the source mesh
+	Math::Vec3<float> center;
+	float radius = 0;
+
+	/* Screen space diameter of the bounding sphere, in cells */
+	float projectedSize(const OrthographicCamera& camera) const {
+		return 2.f * radius * camera.getScale();
+	}
+
+	/* Coarsest level whose error stays under maxCellError cells, meshes under a cell get the last one */
+	const LODLevel& select(const OrthographicCamera& camera, float maxCellError = .5f) const {
+		if (projectedSize(camera) < 1.f) return levels.back();
+		float cellsPerUnit = camera.getScale();
+		size_t best = 0;
+		for (size_t l = 1; l < levels.size(); l++)
+			if (levels[l].error * cellsPerUnit <= maxCellError) best = l;
+		return levels[best];
+	}
+
+};
+
+/* Every level keeps about `ratio` of the previous level triangles, down to minTriangles */
+LODChain buildLODChain(const std::vector<Vertex>& vertices, const std::vector<Index>& indices,
+	int maxLevels = 6, float ratio = .5f, size_t minTriangles = 8)
+{
+	LODChain chain;
+	chain.levels.push_back({ vertices, indices, 0.f });
+
+	// Bounding sphere from the AABB
+	if (!vertices.empty()) {
+		Math::Vec3<float> lo = vertices[0].position, hi = vertices[0].position;
+		for (const Vertex& v : vertices) {
+			lo = { (std::min)(lo.x, v.position.x), (std::min)(lo.y, v.position.y), (std::min)(lo.z, v.position.z) };
+			hi = { (std::max)(hi.x, v.position.x), (std::max)(hi.y, v.position.y), (std::max)(hi.z, v.position.z) };
+		}
+		chain.center = (lo + hi) * .5f;
+		for (const Vertex& v : vertices) {
+			Math::Vec3<float> d = v.position;
+			chain.radius = (std::max)(chain.radius, (d - chain.center).length());
+		}
+	}
+
+	for (int l = 1; l < maxLevels; l++) {
+
+		const LODLevel& previous = chain.levels.back();
+		size_t triangles = previous.indices.size() / 3;
+		size_t target = static_cast<size_t>(triangles * ratio);
+		if (target < minTriangles) break;
+
+		Simplify::Result r = Simplify::simplify(previous.vertices, previous.indices, target);
+		if (r.indices.size() / 3 >= triangles) break; // nothing left to collapse
+
+		float error = previous.error + r.error;
+		chain.levels.push_back({ std::move(r.vertices), std::move(r.indices), error });
+	}
+
+	return chain;
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include "../Utils/Math.h"
+#include "../Utils/SIMD.h"
+#include "../Utils/ParallelFor.h"
+#include "DepthBuffer.h"
+#include "Renderer.h"
+#include "Camera.h"
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+
+/*
+Particle system, stored as structure of arrays so the update runs 4 particles per SIMD
+lane group, split in chunks over the thread pool.
+
+Particles are drawn as point splats and never touch the triangle path: every particle is
+projected to a cell, the cells keep the count and the nearest particle, then each covered
+cell is depth tested once against the depth buffer and gets a glyph from `table`, either
+by how many particles landed in it or by the speed of the nearest one.
+*/
+
+struct ParticleSettings {
+	Math::Vec3<float> gravity{ 0, -9.81f, 0 };
+	float drag = 0.1f;						// fraction of the velocity lost per second
+	float floor = -1e30f;					// particles bounce on the plane y = floor
+	float restitution = 0.5f;
+	int particlesPerTask = 4096;
+};
+
+class ParticleSystem {
+
+public:
+
+	explicit ParticleSystem(size_t capacity)
+		: m_capacity(capacity),
+		px(padded(capacity)), py(padded(capacity)), pz(padded(capacity)),
+		vx(padded(capacity)), vy(padded(capacity)), vz(padded(capacity)),
+		life(padded(capacity))
+	{}
+
+	/* False when the system is full */
+	bool spawn(const Math::Vec3<float>& position, const Math::Vec3<float>& velocity, float lifetime) {
+		if (count == m_capacity) return false;
+		px[count] = position.x; py[count] = position.y; pz[count] = position.z;
+		vx[count] = velocity.x; vy[count] = velocity.y; vz[count] = velocity.z;
+		life[count] = lifetime;
+		count++;
+		return true;
+	}
+
+	void clear() { count = 0; }
+
+	void update(float dt, const ParticleSettings& settings = {}) {
+
+		using namespace SIMD;
+
+		if (count == 0) return;
+
+		const float4 step = dt;
+		const float4 damping = (std::max)(0.f, 1.f - settings.drag * dt);
+		const float4 gx = settings.gravity.x * dt, gy = settings.gravity.y * dt, gz = settings.gravity.z * dt;
+		const float4 floorY = settings.floor, bounce = -settings.restitution;
+
+		// Whole groups of 4, the padding lanes past count are updated too and never read
+		int groups = static_cast<int>((count + 3) / 4);
+		parallelFor(0, groups, (std::max)(1, settings.particlesPerTask / 4), [&](int first, int last) {
+			for (int g = first; g < last; g++) {
+				size_t i = static_cast<size_t>(g) * 4;
+
+				float4 x = float4::load(&px[i]), y = float4::load(&py[i]), z = float4::load(&pz[i]);
+				float4 dx = float4::load(&vx[i]), dy = float4::load(&vy[i]), dz = float4::load(&vz[i]);
+
+				dx = (dx + gx) * damping;
+				dy = (dy + gy) * damping;
+				dz = (dz + gz) * damping;
+				x = x + dx * step;
+				y = y + dy * step;
+				z = z + dz * step;
+
+				float4 below = y < floorY;
+				y = select(below, floorY, y);
+				dy = select(below, dy * bounce, dy);
+
+				x.store(&px[i]); y.store(&py[i]); z.store(&pz[i]);
+				dx.store(&vx[i]); dy.store(&vy[i]); dz.store(&vz[i]);
+				(float4::load(&life[i]) - step).store(&life[i]);
+			}
+		});
+
+		// Swap remove the dead, order does not matter for splatting
+		for (size_t i = 0; i < count;) {
+			if (life[i] > 0.f) { i++; continue; }
+			count--;
+			px[i] = px[count]; py[i] = py[count]; pz[i] = pz[count];
+			vx[i] = vx[count]; vy[i] = vy[count]; vz[i] = vz[count];
+			life[i] = life[count];
+		}
+	}
+
+	size_t size() const { return count; }
+	size_t capacity() const { return m_capacity; }
+
+	// Arrays padded to a multiple of 4, only [0, size()[ is meaningful
+	const float* positionsX() const { return px.data(); }
+	const float* positionsY() const { return py.data(); }
+	const float* positionsZ() const { return pz.data(); }
+	const float* velocitiesX() const { return vx.data(); }
+	const float* velocitiesY() const { return vy.data(); }
+	const float* velocitiesZ() const { return vz.data(); }
+	const float* lifetimes() const { return life.data(); }
+
+private:
+
+	static size_t padded(size_t n) { return (n + 3) & ~size_t(3); }
+
+	size_t m_capacity;
+	size_t count = 0;
+	std::vector<float> px, py, pz;
+	std::vector<float> vx, vy, vz;
+	std::vector<float> life;
+
+};
+
+enum class PARTICLE_GLYPH { DENSITY, SPEED };
+
+struct ParticleStyle {
+	PARTICLE_GLYPH glyph = PARTICLE_GLYPH::DENSITY;
+	float fullDensity = 16.f;	// particles per cell drawn with the densest glyph
+	float fullSpeed = 10.f;		// speed drawn with the densest glyph
+	COLOR color = COLOR::cyan;
+	int particlesPerTask = 8192;
+};
+
+/* Splats every particle into its cell, depth tested against `depth` (dp for the forward path, gbuffer.getDepth() after a resolve) */
+void renderParticles(char* buffer, const OrthographicCamera& camera, const ParticleSystem& particles,
+	depthBuffer& depth = dp, const ParticleStyle& style = {}, bool hasColors = true, ScreenRect clip = {})
+{
+	using namespace SIMD;
+
+	const size_t count = particles.size();
+	if (count == 0) return;
+
+	clip.x1 = (std::min)(clip.x1, SCREEN_WIDTH);
+	clip.y1 = (std::min)(clip.y1, SCREEN_HEIGHT);
+
+	const Math::Vec3<float> position = camera.getPosition();
+	const Math::Vec3<float> left = camera.getLeft(), up = camera.getUp(), forward = camera.getForward();
+	const float scale = camera.getScale();
+	const float halfW = camera.getScreenCenter().u, halfH = camera.getScreenCenter().v;
+	const bool bySpeed = style.glyph == PARTICLE_GLYPH::SPEED;
+
+	// Per particle cell (-1 when clipped), depth and speed
+	thread_local std::vector<int32_t> cells;
+	thread_local std::vector<float> depths, speeds;
+	const size_t padded = (count + 3) & ~size_t(3);
+	cells.resize(padded);
+	depths.resize(padded);
+	if (bySpeed) speeds.resize(padded);
+	// Thread locals would resolve to the workers' own copies inside the jobs
+	int32_t* cellsOut = cells.data();
+	float* depthsOut = depths.data();
+	float* speedsOut = speeds.data();
+
+	const float* xs = particles.positionsX();
+	const float* ys = particles.positionsY();
+	const float* zs = particles.positionsZ();
+
+	// -- Projection, same mapping as OrthographicCamera::toScreenCoords
+
+	int groups = static_cast<int>(padded / 4);
+	parallelFor(0, groups, (std::max)(1, style.particlesPerTask / 4), [&](int first, int last) {
+		for (int g = first; g < last; g++) {
+			size_t i = static_cast<size_t>(g) * 4;
+
+			vec3x4 rel = {
+				float4::load(xs + i) - float4(position.x),
+				float4::load(ys + i) - float4(position.y),
+				float4::load(zs + i) - float4(position.z)
+			};
+			float4 u = dot(rel, { left.x, left.y, left.z }) * float4(scale) + float4(halfW);
+			float4 v = dot(rel, { up.x, up.y, up.z }) * float4(scale) + float4(halfH);
+			float4 d = dot(rel, { forward.x, forward.y, forward.z });
+
+			float4 inside = (u >= float4(static_cast<float>(clip.x0))) & (u < float4(static_cast<float>(clip.x1)))
+				& (v >= float4(static_cast<float>(clip.y0))) & (v < float4(static_cast<float>(clip.y1)))
+				& (d >= float4(0.f))
+				& (float4::ramp(static_cast<float>(i), 1.f) < float4(static_cast<float>(count)));
+
+			int4 cell = floorToInt(v) * int4(SCREEN_WIDTH) + floorToInt(u);
+			asInt(select(inside, asFloat(cell), asFloat(int4(-1)))).store(cellsOut + i);
+			d.store(depthsOut + i);
+
+			if (bySpeed) {
+				vec3x4 velocity = {
+					float4::load(particles.velocitiesX() + i),
+					float4::load(particles.velocitiesY() + i),
+					float4::load(particles.velocitiesZ() + i)
+				};
+				length(velocity).store(speedsOut + i);
+			}
+		}
+	});
+
+	// -- Binning, serial scatter, only the touched cells are reset afterwards
+
+	thread_local std::vector<uint32_t> cellCount;
+	thread_local std::vector<float> cellDepth, cellSpeed;
+	thread_local std::vector<int32_t> touched;
+	if (cellCount.size() != SCREEN_WIDTH * SCREEN_HEIGHT) {
+		cellCount.assign(SCREEN_WIDTH * SCREEN_HEIGHT, 0);
+		cellDepth.assign(SCREEN_WIDTH * SCREEN_HEIGHT, 0.f);
+		cellSpeed.assign(SCREEN_WIDTH * SCREEN_HEIGHT, 0.f);
+	}
+	touched.clear();
+
+	for (size_t i = 0; i < count; i++) {
+		int32_t c = cells[i];
+		if (c < 0) continue;
+		if (cellCount[c]++ == 0) {
+			touched.push_back(c);
+			cellDepth[c] = depths[i];
+			if (bySpeed) cellSpeed[c] = speeds[i];
+		}
+		else if (depths[i] < cellDepth[c]) {
+			cellDepth[c] = depths[i];
+			if (bySpeed) cellSpeed[c] = speeds[i];
+		}
+	}
+
+	// -- One depth test and one glyph per covered cell
+
+	const float densityScale = 1.f / std::log(1.f + (std::max)(1.f, style.fullDensity));
+
+	for (int32_t c : touched) {
+
+		int x = c % SCREEN_WIDTH, y = c / SCREEN_WIDTH;
+		float intensity = bySpeed
+			? cellSpeed[c] / style.fullSpeed
+			: std::log(1.f + cellCount[c]) * densityScale; // log so a few particles still read as something
+		cellCount[c] = 0;
+
+		if (!depth.depthTest(x, y, cellDepth[c])) continue;
+
+		intensity = (intensity < 0.f) ? 0.f : (intensity > 1.f) ? 1.f : intensity;
+		char character = table[9 - int(intensity * 9)];
+
+		if (hasColors) writeColoredCell(buffer, SCREEN_WIDTH, x, y, character, style.color);
+		else buffer[y * SCREEN_WIDTH + x] = character;
+	}
+}
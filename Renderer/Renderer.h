@@ -9,6 +9,8 @@
 #include <tuple>
 #include <vector>
 #include <array>
+#include <cstdint>
+#include <cstdlib>
 
 #include "../Utils/Math.h"
 #include "DepthBuffer.h"
@@ -35,6 +37,7 @@ constexpr int64_t WHITE_CLEAR_CHAR = 0x2e6d39333b305b1b;
 void renderBuffer(char* buffer, size_t size) {
 
 	std::cout.write(buffer, size);
+	std::cout.flush(); // the end of the frame would otherwise wait for the next one
 }
 
 void preventResize(char* buffer, bool hasColors=true) {
@@ -56,6 +59,10 @@ void clear(char* buffer) {
 
 }
 
+void resetCursor() {
+	SetConsoleCursorPosition(GetStdHandle(STD_OUTPUT_HANDLE), { 0,0 });
+}
+
 /* Resets the screenbuffer and puts the cursor position at 0,0 */
 void clearScreenBuffer(char* buffer, bool hasColor=false) 
 {
@@ -63,13 +70,18 @@ void clearScreenBuffer(char* buffer, bool hasColor=false)
 	hasColor ?
 		std::fill((int64_t*)buffer, (int64_t*)(buffer + SCREEN_HEIGHT * SCREEN_WIDTH * 8), WHITE_CLEAR_CHAR) :
 		std::fill(buffer, (buffer + SCREEN_HEIGHT * SCREEN_WIDTH), '.') ;
-	SetConsoleCursorPosition(GetStdHandle(STD_OUTPUT_HANDLE), { 0,0 });
+	resetCursor();
 }
 
 void clearDepth() {
 	dp.clear();
 }
 
+/* Back to the clear glyph, colored layout only */
+void clearCell(char* buffer, int width, int x, int y) {
+	*reinterpret_cast<int64_t*>(buffer + (y * width + x) * 8) = WHITE_CLEAR_CHAR;
+}
+
 void setPixelChar(char* buffer,int width, int x, int y, char c) 
 {
 	if (static_cast<unsigned>(y * width + x) > SCREEN_HEIGHT * SCREEN_HEIGHT) return;
@@ -85,20 +97,25 @@ void setPixelCharWithDepth(char* buffer, int width, int x, int y, char c, float
 	}
 }
 
+/* Writes a cell without depth testing, the colored layout is ESC[0;3Xm followed by the glyph */
+void writeColoredCell(char* buffer, int width, int x, int y, char c, COLOR color) {
+
+	buffer[(y * width + x) * 8] = '\033';
+	buffer[1 + (y * width + x) * 8] = '[';
+	buffer[2 + (y * width + x) * 8] = '0';
+	buffer[3 + (y * width + x) * 8] = ';';
+	buffer[4 + (y * width + x) * 8] = '3';
+	buffer[5 + (y * width + x) * 8] = (char)(color) + '0';
+	buffer[6 + (y * width + x) * 8] = 'm';
+	buffer[7 + (y * width + x) * 8] = c;
+}
+
 void setPixelWithColor(char* buffer, int width, int x, int y, char c, float depth, COLOR color) {
 
 	if (static_cast<unsigned long>(y * width + x) > SCREEN_WIDTH * SCREEN_HEIGHT * 8) return;
 	if (depth < dp.getAt(x, y)) {
 		dp.setAt(x, y, depth);
-
-		buffer[(y * width + x) * 8] = '\033';
-		buffer[1 + (y * width + x) * 8] = '[';
-		buffer[2 + (y * width + x) * 8] = '0';
-		buffer[3 + (y * width + x) * 8] = ';';
-		buffer[4 + (y * width + x) * 8] = '3';
-		buffer[5 + (y * width + x) * 8] = (char)(color) + '0';
-		buffer[6 + (y * width + x) * 8] = 'm';
-		buffer[7 + (y * width + x) * 8] = c;
+		writeColoredCell(buffer, width, x, y, c, color);
 	}
 
 }
@@ -115,64 +132,41 @@ Math::Vec3<float> getWeights(Math::uVec2 p, Math::uVec2 v1, Math::uVec2 v2, Math
 
 }
 
-// bresenhams
-void drawLine(char* buffer, Math::uVec2 a, Math::uVec2 b, int width) 
-{
-	bool isHorizontal = abs(b.u - a.u) > abs(b.v - a.v);
-
-	if (isHorizontal) {
-
-		bool swap = (b.u < a.u);
-		if (swap) std::swap(a, b);
-
-		for (int x = a.u; x < b.u; x++) 
-		{
-			int y = a.v + ((x - a.u)*(b.v - a.v)) / (b.u - a.u);
-			setPixelChar(buffer, width, x, y, '@');
-
-		}
-
-	}
-	else {
-		bool swap = (b.v < a.v);
-		if (swap) std::swap(a, b);
-
-		for (int y = a.v; y < b.v; y++)
-		{
-			int x = a.u + ((y - a.v) * (b.u - a.u)) / (b.v - a.v);
-			setPixelChar(buffer, width, x, y, '@');
+/* Screen-space clip rectangle, [x0,x1[ x [y0,y1[ */
+struct ScreenRect {
+	int x0 = 0, y0 = 0;
+	int x1 = SCREEN_WIDTH, y1 = SCREEN_HEIGHT;
+};
 
-		}
+/* clearScreenBuffer limited to rect, the cursor is left alone */
+void clearScreenRect(char* buffer, ScreenRect rect, bool hasColor=false)
+{
+	for (int y = rect.y0; y < rect.y1; y++) {
+		hasColor ?
+			std::fill((int64_t*)buffer + y * SCREEN_WIDTH + rect.x0, (int64_t*)buffer + y * SCREEN_WIDTH + rect.x1, WHITE_CLEAR_CHAR) :
+			std::fill(buffer + y * SCREEN_WIDTH + rect.x0, buffer + y * SCREEN_WIDTH + rect.x1, '.');
 	}
 }
 
-void drawWireframeTriangle(char* buffer, int width, Math::uVec2 a, Math::uVec2 b, Math::uVec2 c) {
-
-	drawLine(buffer, a, b, width);
-	drawLine(buffer, b, c, width);
-	drawLine(buffer, c, a, width);
-
-}
-
-
 /*
 Thanks bisqwit
 https://www.youtube.com/watch?v=PahbNFypubE& 
 */
-// TODO CHANGE ALL OF THIS ! WHY IS THE SUN IN THIS ?? 
-void drawFilledTriangle(char* buffer, int width,
-	Math::uVec2 a, Math::uVec2 b, Math::uVec2 c,
-	std::array<Math::Vec3<float>, 3> normals,
-	Math::Vec3<float> depths = { 0,0,0 }, bool drawOutline = false
-)
-
+// Scan converts the triangle abc and calls fragment(x, y, weights) for every covered cell inside clip.
+// The barycentric weights are given relative to the original a, b, c order so callers never have to
+// reorder their per-vertex attributes.
+template<typename Fragment>
+void scanTriangle(Math::uVec2 a, Math::uVec2 b, Math::uVec2 c, Fragment&& fragment, ScreenRect clip = {})
 {
+	const Math::uVec2 oa = a, ob = b, oc = c;
+
+	// Weights are affine in x, step them along the scanline instead of solving per pixel
+	int area = (ob.v - oc.v) * (oa.u - oc.u) + (oc.u - ob.u) * (oa.v - oc.v);
+	if (area == 0) return;
+	float factor = 1.f / static_cast<float>(area);
+	Math::Vec3<float> wStep = { (ob.v - oc.v) * factor, (oc.v - oa.v) * factor, 0.f };
+	wStep.z = -wStep.x - wStep.y;
 
-	//COLOR randomColor = COLOR(rand() % (char)COLOR::Default);
-	COLOR randomColor;
-	Math::Vec3<float> surfaceNormal;
-	Math::Vec3<float> sunPos = { 7,9,5 };
-	// Sort the points
 	using slope_data = std::pair<float/*start*/, float/*step*/>;
 	auto MakeSlope = [](Math::uVec2 from, Math::uVec2 to, int numstep) -> slope_data {
 
@@ -181,20 +175,17 @@ void drawFilledTriangle(char* buffer, int width,
 		return { begin, (end - begin) * inv_step };
 	};
 
-	auto DrawScanline = [&](char ch, int y, slope_data& left, slope_data& right)
+	auto DrawScanline = [&](int y, slope_data& left, slope_data& right)
 	{
-
-		int x = left.first;
-		int endx = right.first;
-
-		for (; x < endx; ++x) {
-			Math::Vec3<float> w = getWeights({ x,y }, a, b, c);
-			surfaceNormal = (normals[0]*w.x)+ (normals[1] * w.y)+ (normals[2] * w.z);
-			float d = Math::dot(depths, w);
-
-			// -- Change this for color
-			//setPixelCharWithDepth(buffer, width, x, y, ch, d);
-			setPixelWithColor(buffer, width, x, y, ch, d, randomColor);
+		int x = (std::max)(static_cast<int>(left.first), clip.x0);
+		int endx = (std::min)(static_cast<int>(right.first), clip.x1);
+
+		if (y >= clip.y0 && y < clip.y1 && x < endx) {
+			Math::Vec3<float> w = getWeights({ x,y }, oa, ob, oc);
+			for (; x < endx; ++x) {
+				fragment(x, y, w);
+				w = w + wStep;
+			}
 		}
 		left.first += left.second;
 		right.first += right.second;
@@ -206,23 +197,18 @@ void drawFilledTriangle(char* buffer, int width,
 		std::tuple(b.u, b.v),
 		std::tuple(c.u, c.v));
 
-
+	// Sort the points
 	if (std::tie(y1, x1) < std::tie(y0, x0)) {
 		std::swap(x0, x1); std::swap(y0, y1);
-		std::swap(a, b); std::swap(depths.x, depths.y);
-		std::swap(normals[0], normals[1]);
+		std::swap(a, b);
 	}
-
-
 	if (std::tie(y2, x2) < std::tie(y0, x0)) {
 		std::swap(x0, x2); std::swap(y0, y2); 
-		std::swap(a, c);std::swap(depths.x, depths.z);
-		std::swap(normals[0], normals[2]);
+		std::swap(a, c);
 	}
 	if (std::tie(y2, x2) < std::tie(y1, x1)) {
 		std::swap(x1, x2); std::swap(y1, y2);
-	std::swap(b, c);std::swap(depths.y, depths.z);
-	std::swap(normals[1], normals[2]);
+		std::swap(b, c);
 	}
 
 	// Refuse to draw arealess triangles.
@@ -243,21 +229,13 @@ void drawFilledTriangle(char* buffer, int width,
 	// The main rasterizing loop. Note that this is intentionally designed such that
 	// there's only one place where DrawScanline() is invoked. This will minimize the
 	// chances that the compiler fails to inline the functor.
-	surfaceNormal = (normals[0] + normals[1] + normals[2]).normalize();
-
-	randomColor = (Math::dot(surfaceNormal, { 0,1,0 }) > 0.75f) ? COLOR::green : COLOR::white;
-
-	Math::Vec3<float> sunDir = (sunPos).normalize();
-	float sunLight = max(0.f, Math::dot(sunDir, surfaceNormal));
-	char character = table[9-int(sunLight * 9)];
-
 	if (int(y0) < int(y1))
 	{
 		// Calculate the first slope for short side. The number of lines cannot be zero.
 		sides[shortside] = MakeSlope(a, b, y1 - y0);
 		for (int y = y0; y < int(y1); ++y)
 		{
-			DrawScanline(character, y, sides[0], sides[1]);
+			DrawScanline(y, sides[0], sides[1]);
 		}
 	}
 	if (int(y1) < int(y2))
@@ -266,33 +244,228 @@ void drawFilledTriangle(char* buffer, int width,
 		sides[shortside] = MakeSlope(b, c, y2 - y1);
 		for (int y = y1; y < int(y2); ++y)
 		{
-			
-			DrawScanline(character, y, sides[0], sides[1]);
+			DrawScanline(y, sides[0], sides[1]);
 		}
 	}
-	if (drawOutline) 
-	{
-		drawLine(buffer, a, b, width);
-		drawLine(buffer, b, c, width);
-		drawLine(buffer, c, a, width);	
+}
+
+/*
+Scan converts the segment ab, both endpoints included, and calls plot(x, y, depth) for every
+cell inside clip. Integer DDA along the major axis: the minor axis moves through an error
+term and the depth is a multiply-add of the step index, nothing is divided per cell. The major axis is clipped
+before stepping and the walk stops once the minor axis left the clip, so a segment never
+costs more than the clip size however far its endpoints are.
+*/
+template<typename Plot>
+void scanLine(Math::uVec2 a, Math::uVec2 b, float da, float db, Plot&& plot, ScreenRect clip = {})
+{
+	if ((a.u < clip.x0 && b.u < clip.x0) || (a.u >= clip.x1 && b.u >= clip.x1) ||
+		(a.v < clip.y0 && b.v < clip.y0) || (a.v >= clip.y1 && b.v >= clip.y1)) return;
+
+	bool xMajor = std::abs(b.u - a.u) >= std::abs(b.v - a.v);
+
+	// Always walk the major axis forward
+	if (xMajor ? (b.u < a.u) : (b.v < a.v)) {
+		std::swap(a, b);
+		std::swap(da, db);
+	}
+
+	const int majorStart = xMajor ? a.u : a.v, minorStart = xMajor ? a.v : a.u;
+	const int64_t major = xMajor ? b.u - a.u : b.v - a.v;
+	const int64_t minor = std::abs(xMajor ? b.v - a.v : b.u - a.u);
+	const int minorStep = ((xMajor ? b.v - a.v : b.u - a.u) < 0) ? -1 : 1;
+	const int majorLo = xMajor ? clip.x0 : clip.y0, majorHi = xMajor ? clip.x1 : clip.y1;
+	const int minorLo = xMajor ? clip.y0 : clip.x0, minorHi = xMajor ? clip.y1 : clip.x1;
+
+	int64_t first = (std::max)(int64_t(0), int64_t(majorLo - majorStart));
+	int64_t last = (std::min)(major, int64_t(majorHi - 1 - majorStart));
+	if (first > last) return;
+
+	// Minor coordinate at step k is minorStart + round(k * minor / major), rounding half up
+	const int64_t twoMajor = 2 * major;
+	int64_t n = 2 * first * minor + major;
+	int m = minorStart + minorStep * static_cast<int>(major ? n / twoMajor : 0);
+	int64_t error = major ? n % twoMajor : 0;
+	float depthStep = major ? (db - da) / static_cast<float>(major) : 0.f;
+
+	for (int64_t k = first; k <= last; k++) {
+		if (m >= minorLo && m < minorHi) {
+			// From the step index and not accumulated, a cell gets the same depth whatever the clip
+			float depth = da + depthStep * static_cast<float>(k);
+			int p = majorStart + static_cast<int>(k);
+			xMajor ? plot(p, m, depth) : plot(m, p, depth);
+		}
+		else if ((minorStep > 0) ? m >= minorHi : m < minorLo) return;
+		error += 2 * minor;
+		if (error >= twoMajor) {
+			error -= twoMajor;
+			m += minorStep;
+		}
 	}
-	
 }
 
+/* Glyph following the screen slope, rows grow downwards */
+char lineGlyph(int dx, int dy) {
+	int ax = std::abs(dx), ay = std::abs(dy);
+	if (2 * ay < ax) return '-';
+	if (2 * ax < ay) return '|';
+	return ((dx > 0) == (dy > 0)) ? '\\' : '/';
+}
 
-enum class RENDER_MODE { WIREFRAME, FILLED };
+// Lines are pulled towards the camera by that much so they win over the faces they lie on
+constexpr float LINE_DEPTH_BIAS = 0.02f;
+
+/* Depth tested against dp, hidden parts are dropped once the faces are in the depth buffer */
+void drawLine(char* buffer, int width, Math::uVec2 a, Math::uVec2 b, float da, float db,
+	COLOR color = COLOR::white, ScreenRect clip = {})
+{
+	char character = lineGlyph(b.u - a.u, b.v - a.v);
+	scanLine(a, b, da, db, [&](int x, int y, float d) {
+		setPixelWithColor(buffer, width, x, y, character, d - LINE_DEPTH_BIAS, color);
+	}, clip);
+}
+
+/*
+Unique undirected edges of a triangle list, each one given by the corner (3 * triangle + k) of
+the first triangle using it, going to the next corner of that triangle. Sorted, so the edges
+come grouped by the triangle ranges that own them.
+*/
+void extractEdgeCorners(const Index* indices, size_t indexCount, std::vector<uint32_t>& out) {
+
+	std::vector<std::pair<uint64_t, uint32_t>> keys;
+	keys.reserve(indexCount);
+	for (size_t t = 0; t + 2 < indexCount; t += 3) {
+		for (int e = 0; e < 3; e++) {
+			Index a = indices[t + e], b = indices[t + (e + 1) % 3];
+			if (a == b) continue;
+			if (a > b) std::swap(a, b);
+			keys.push_back({ (static_cast<uint64_t>(a) << 32) | b, static_cast<uint32_t>(t + e) });
+		}
+	}
+	std::sort(keys.begin(), keys.end());
+
+	size_t first = out.size();
+	for (size_t k = 0; k < keys.size(); k++)
+		if (k == 0 || keys[k].first != keys[k - 1].first) out.push_back(keys[k].second);
+	std::sort(out.begin() + first, out.end());
+}
+
+uint32_t nextCorner(uint32_t corner) { return corner - corner % 3 + (corner + 1) % 3; }
+
+/* Unique undirected edges of a triangle list, appended to out as index pairs */
+void extractEdges(const Index* indices, size_t indexCount, std::vector<Index>& out) {
+
+	std::vector<uint32_t> corners;
+	extractEdgeCorners(indices, indexCount, corners);
+	for (uint32_t c : corners) {
+		out.push_back(indices[c]);
+		out.push_back(indices[nextCorner(c)]);
+	}
+}
+
+/* Draws every edge once, the vertices are projected once no matter how many edges share them */
+void renderEdges(char* buffer, const OrthographicCamera& camera,
+	const Vertex* vertices, const Index* edges, size_t edgeIndexCount,
+	COLOR color = COLOR::white, ScreenRect clip = {})
+{
+	if (edgeIndexCount < 2) return;
+
+	Index vertexCount = 0;
+	for (size_t e = 0; e < edgeIndexCount; e++) vertexCount = (std::max)(vertexCount, edges[e] + 1);
+
+	auto camForward = camera.getForward();
+	float camDepth = dot(camera.getPosition(), camForward);
+
+	thread_local std::vector<Math::uVec2> points;
+	thread_local std::vector<float> depths;
+	points.resize(vertexCount);
+	depths.resize(vertexCount);
+	for (Index v = 0; v < vertexCount; v++) {
+		points[v] = camera.toScreenCoords(camera.toCamCoords(vertices[v].position));
+		depths[v] = dot(vertices[v].position, camForward) - camDepth;
+	}
+
+	for (size_t e = 0; e + 1 < edgeIndexCount; e += 2) {
+		Index a = edges[e], b = edges[e + 1];
+		drawLine(buffer, SCREEN_WIDTH, points[a], points[b], depths[a], depths[b], color, clip);
+	}
+}
+
+/* Depth only fill with the clear glyph, hides the lines behind the face */
+void drawMaskTriangle(char* buffer, int width, Math::uVec2 a, Math::uVec2 b, Math::uVec2 c,
+	Math::Vec3<float> depths, ScreenRect clip = {})
+{
+	scanTriangle(a, b, c, [&](int x, int y, Math::Vec3<float> w) {
+		if (dp.depthTest(x, y, Math::dot(depths, w))) clearCell(buffer, width, x, y);
+	}, clip);
+}
+
+/* Flat shading of a face, camera independent: glyph lit by the fixed sun, color from the slope */
+struct FaceShade {
+	char character;
+	COLOR color;
+};
+
+FaceShade shadeFace(std::array<Math::Vec3<float>, 3> normals)
+{
+	Math::Vec3<float> sunPos = { 7,9,5 };
+
+	Math::Vec3<float> surfaceNormal = (normals[0] + normals[1] + normals[2]).normalize();
+
+	COLOR faceColor = (Math::dot(surfaceNormal, { 0,1,0 }) > 0.75f) ? COLOR::green : COLOR::white;
+
+	Math::Vec3<float> sunDir = (sunPos).normalize();
+	float sunLight = max(0.f, Math::dot(sunDir, surfaceNormal));
+	return { table[9-int(sunLight * 9)], faceColor };
+}
+
+void drawShadedTriangle(char* buffer, int width,
+	Math::uVec2 a, Math::uVec2 b, Math::uVec2 c, FaceShade shade,
+	Math::Vec3<float> depths = { 0,0,0 }, ScreenRect clip = {}
+)
+{
+	scanTriangle(a, b, c, [&](int x, int y, Math::Vec3<float> w) {
+		float d = Math::dot(depths, w);
+
+		// -- Change this for color
+		//setPixelCharWithDepth(buffer, width, x, y, shade.character, d);
+		setPixelWithColor(buffer, width, x, y, shade.character, d, shade.color);
+	}, clip);
+}
+
+// Forward path: lighting is resolved once per triangle, see Deferred.h for per-cell shading
+void drawFilledTriangle(char* buffer, int width,
+	Math::uVec2 a, Math::uVec2 b, Math::uVec2 c,
+	std::array<Math::Vec3<float>, 3> normals,
+	Math::Vec3<float> depths = { 0,0,0 }, ScreenRect clip = {}
+)
+
+{
+	drawShadedTriangle(buffer, width, a, b, c, shadeFace(normals), depths, clip);
+}
+
+
+enum class RENDER_MODE {
+	WIREFRAME,		// edges only, the nearest edge wins a cell
+	FILLED,
+	OUTLINED,		// filled, then the edges on top
+	HIDDEN_LINE		// edges over faces filled with the clear glyph, hidden edges are dropped
+};
 
 // todo add perspective
 // todo clean
-void renderMesh(char* buffer, const OrthographicCamera& camera,
-	const std::vector<Vertex>& vertices, const std::vector<Index>& indices,
-	RENDER_MODE mode= RENDER_MODE::FILLED)
+// edges are index pairs as given by extractEdges, when not given they are extracted on every call:
+// cache them for meshes drawn every frame
+void renderTriangles(char* buffer, const OrthographicCamera& camera,
+	const Vertex* vertices, const Index* indices, size_t indexCount,
+	RENDER_MODE mode= RENDER_MODE::FILLED, ScreenRect clip = {},
+	const Index* edges = nullptr, size_t edgeIndexCount = 0)
 {
 
 	auto camForward = camera.getForward();
 	auto camPos = camera.getPosition();
 
-	for (int id = 0; id < indices.size(); id += 3) {
+	for (size_t id = 0; mode != RENDER_MODE::WIREFRAME && id + 2 < indexCount; id += 3) {
 
 		Index i1 = indices[id];
 		Index i2 = indices[id + 1];
@@ -314,9 +487,28 @@ void renderMesh(char* buffer, const OrthographicCamera& camera,
 		};
 		std::array<Math::Vec3<float>, 3> normals = { v1.normal, v2.normal, v3.normal };
 
-		(mode == RENDER_MODE::FILLED) ? 
-			drawFilledTriangle(buffer, SCREEN_WIDTH, p1, p2, p3, normals, depths):
-			drawWireframeTriangle(buffer, SCREEN_WIDTH, p1, p2, p3);
+		(mode == RENDER_MODE::HIDDEN_LINE) ?
+			drawMaskTriangle(buffer, SCREEN_WIDTH, p1, p2, p3, depths, clip):
+			drawFilledTriangle(buffer, SCREEN_WIDTH, p1, p2, p3, normals, depths, clip);
 	}
 
+	if (mode == RENDER_MODE::FILLED) return;
+
+	if (!edges) {
+		thread_local std::vector<Index> extracted;
+		extracted.clear();
+		extractEdges(indices, indexCount, extracted);
+		edges = extracted.data();
+		edgeIndexCount = extracted.size();
+	}
+	renderEdges(buffer, camera, vertices, edges, edgeIndexCount, COLOR::white, clip);
+
+}
+
+void renderMesh(char* buffer, const OrthographicCamera& camera,
+	const std::vector<Vertex>& vertices, const std::vector<Index>& indices,
+	RENDER_MODE mode= RENDER_MODE::FILLED, const std::vector<Index>* edges = nullptr)
+{
+	renderTriangles(buffer, camera, vertices.data(), indices.data(), indices.size(), mode, {},
+		edges ? edges->data() : nullptr, edges ? edges->size() : 0);
 }
\ No newline at end of file
@@ -0,0 +1,241 @@
+#pragma once
+
+#include "../Utils/Math.h"
+#include "../Utils/SIMD.h"
+#include "../Utils/ParallelFor.h"
+#include "Renderer.h"
+#include "Deferred.h"
+#include "Camera.h"
+
+#include <vector>
+#include <cmath>
+
+/*
+Signed distance field render mode.
+
+The SDF scene is a small node graph (primitives, boolean / smooth operators, transforms)
+evaluated on 4 points at once. renderSDF() marches one ray per cell, 4 neighbouring cells
+per packet, rows split over the thread pool, and writes depth / normal / material into the
+G-buffer so resolveDeferred() lights it exactly like rasterized geometry. Both can share
+the same G-buffer, the depth test sorts them out.
+*/
+
+enum class SDF_OP {
+	SPHERE, BOX, TORUS, PLANE,
+	UNION, SMOOTH_UNION, SUBTRACT, INTERSECT,
+	TRANSLATE, SCALE, ROTATE_Y
+};
+
+struct SDFNode {
+	SDF_OP op;
+	Math::Vec3<float> v;	// sphere: radius in x, box: half extents, torus: (major, minor), plane: normal
+							// translate: offset, scale: factor in x, rotate: (cos, sin) of the angle
+	float k = 0;			// smooth union radius, plane offset
+	int a = -1, b = -1;		// children
+	MaterialId material = 0;
+};
+
+class SDFScene {
+
+public:
+
+	struct Sample {
+		SIMD::float4 distance;
+		SIMD::float4 material; // MaterialId as float, per lane
+	};
+
+	// -- Primitives, centered on the origin
+
+	int sphere(float radius, MaterialId material = 0) { return push({ SDF_OP::SPHERE, { radius, 0, 0 }, 0, -1, -1, material }); }
+	int box(Math::Vec3<float> halfExtents, MaterialId material = 0) { return push({ SDF_OP::BOX, halfExtents, 0, -1, -1, material }); }
+	int torus(float major, float minor, MaterialId material = 0) { return push({ SDF_OP::TORUS, { major, minor, 0 }, 0, -1, -1, material }); }
+	/* dot(p, normal) + offset, normal must be normalized */
+	int plane(Math::Vec3<float> normal, float offset, MaterialId material = 0) { return push({ SDF_OP::PLANE, normal, offset, -1, -1, material }); }
+
+	// -- Operators
+
+	int unite(int a, int b) { return push({ SDF_OP::UNION, {}, 0, a, b }); }
+	int smoothUnion(int a, int b, float k) { return push({ SDF_OP::SMOOTH_UNION, {}, k, a, b }); }
+	int subtract(int a, int b) { return push({ SDF_OP::SUBTRACT, {}, 0, a, b }); }
+	int intersect(int a, int b) { return push({ SDF_OP::INTERSECT, {}, 0, a, b }); }
+
+	// -- Transforms of a child
+
+	int translate(int a, Math::Vec3<float> offset) { return push({ SDF_OP::TRANSLATE, offset, 0, a }); }
+	int scale(int a, float s) { return push({ SDF_OP::SCALE, { s, 0, 0 }, 0, a }); }
+	int rotateY(int a, float angle) { return push({ SDF_OP::ROTATE_Y, { std::cos(angle), std::sin(angle), 0 }, 0, a }); }
+
+	/* Nodes can be edited in place to animate the scene */
+	SDFNode& node(int n) { return nodes[n]; }
+	void setRotation(int n, float angle) { nodes[n].v = { std::cos(angle), std::sin(angle), 0 }; }
+
+	/* The last node added is the root unless set otherwise */
+	void setRoot(int n) { root = n; }
+	bool empty() const { return nodes.empty(); }
+
+	Sample evaluate(const SIMD::vec3x4& p) const { return eval(root, p); }
+
+	float distance(const Math::Vec3<float>& p) const {
+		return evaluate({ SIMD::float4(p.x), SIMD::float4(p.y), SIMD::float4(p.z) }).distance[0];
+	}
+
+private:
+
+	int push(const SDFNode& n) {
+		nodes.push_back(n);
+		root = static_cast<int>(nodes.size()) - 1;
+		return root;
+	}
+
+	Sample eval(int n, const SIMD::vec3x4& p) const {
+
+		using namespace SIMD;
+		const SDFNode& node = nodes[n];
+		float4 material = static_cast<float>(node.material);
+
+		switch (node.op) {
+
+		case SDF_OP::SPHERE:
+			return { length(p) - float4(node.v.x), material };
+
+		case SDF_OP::BOX: {
+			vec3x4 q = { abs(p.x) - float4(node.v.x), abs(p.y) - float4(node.v.y), abs(p.z) - float4(node.v.z) };
+			float4 outside = length({ vmax(q.x, 0.f), vmax(q.y, 0.f), vmax(q.z, 0.f) });
+			float4 inside = vmin(vmax(q.x, vmax(q.y, q.z)), 0.f);
+			return { outside + inside, material };
+		}
+
+		case SDF_OP::TORUS: {
+			float4 ring = sqrt(p.x * p.x + p.z * p.z) - float4(node.v.x);
+			return { sqrt(ring * ring + p.y * p.y) - float4(node.v.y), material };
+		}
+
+		case SDF_OP::PLANE:
+			return { p.x * float4(node.v.x) + p.y * float4(node.v.y) + p.z * float4(node.v.z) + float4(node.k), material };
+
+		case SDF_OP::UNION: {
+			Sample a = eval(node.a, p), b = eval(node.b, p);
+			return { vmin(a.distance, b.distance), select(a.distance < b.distance, a.material, b.material) };
+		}
+
+		case SDF_OP::SMOOTH_UNION: {
+			Sample a = eval(node.a, p), b = eval(node.b, p);
+			float4 k = node.k;
+			float4 h = clamp(float4(.5f) + float4(.5f) * (b.distance - a.distance) / k, 0.f, 1.f);
+			float4 d = b.distance + (a.distance - b.distance) * h - k * h * (float4(1.f) - h);
+			return { d, select(a.distance < b.distance, a.material, b.material) };
+		}
+
+		case SDF_OP::SUBTRACT: {
+			Sample a = eval(node.a, p), b = eval(node.b, p);
+			return { vmax(a.distance, -b.distance), a.material };
+		}
+
+		case SDF_OP::INTERSECT: {
+			Sample a = eval(node.a, p), b = eval(node.b, p);
+			return { vmax(a.distance, b.distance), select(a.distance > b.distance, a.material, b.material) };
+		}
+
+		case SDF_OP::TRANSLATE:
+			return eval(node.a, { p.x - float4(node.v.x), p.y - float4(node.v.y), p.z - float4(node.v.z) });
+
+		case SDF_OP::SCALE: {
+			float4 s = node.v.x;
+			Sample r = eval(node.a, p * (float4(1.f) / s));
+			return { r.distance * s, r.material };
+		}
+
+		case SDF_OP::ROTATE_Y: {
+			// Inverse rotation of the sample point, same convention as Transform::rotate
+			float4 c = node.v.x, s = node.v.y;
+			return eval(node.a, { c * p.x - s * p.z, p.y, s * p.x + c * p.z });
+		}
+
+		}
+		return { float4(1e30f), material };
+	}
+
+	std::vector<SDFNode> nodes;
+	int root = -1;
+
+};
+
+struct RaymarchSettings {
+	int maxSteps = 96;
+	float maxDistance = 40.f;
+	float epsilon = 1e-3f;
+	int rowsPerTask = 4;
+};
+
+/* Ray marches every cell of clip into the G-buffer, rays start on the camera plane (depth 0) */
+void renderSDF(GBuffer& gbuffer, const OrthographicCamera& camera, const SDFScene& scene,
+	ScreenRect clip = {}, const RaymarchSettings& settings = {})
+{
+	using namespace SIMD;
+
+	if (scene.empty()) return;
+
+	clip.x1 = (std::min)(clip.x1, gbuffer.getWidth());
+	clip.y1 = (std::min)(clip.y1, gbuffer.getHeight());
+
+	const Math::Vec3<float> position = camera.getPosition();
+	const Math::Vec3<float> left = camera.getLeft(), up = camera.getUp(), forward = camera.getForward();
+	const float scale = camera.getScale();
+	const float halfW = camera.getScreenCenter().u, halfH = camera.getScreenCenter().v;
+
+	const vec3x4 dir = { forward.x, forward.y, forward.z };
+
+	parallelFor(clip.y0, clip.y1, settings.rowsPerTask, [&](int firstRow, int lastRow) {
+
+		for (int y = firstRow; y < lastRow; y++) {
+
+			float v = (y + .5f - halfH) / scale;
+			Math::Vec3<float> rowOrigin = { position.x + up.x * v, position.y + up.y * v, position.z + up.z * v };
+
+			for (int x = clip.x0; x < clip.x1; x += 4) {
+
+				// Cell centers of the packet, lanes past the clip are disabled from the start
+				float4 u = (float4::ramp(x + .5f, 1.f) - float4(halfW)) / float4(scale);
+				vec3x4 origin = {
+					float4(rowOrigin.x) + u * float4(left.x),
+					float4(rowOrigin.y) + u * float4(left.y),
+					float4(rowOrigin.z) + u * float4(left.z)
+				};
+
+				float4 active = float4::ramp(static_cast<float>(x), 1.f) < float4(static_cast<float>(clip.x1));
+				float4 hit = 0.f;
+				float4 t = 0.f;
+
+				for (int step = 0; step < settings.maxSteps && any(active); step++) {
+					float4 d = scene.evaluate(origin + dir * t).distance;
+					float4 hitNow = active & (d < float4(settings.epsilon));
+					hit = hit | hitNow;
+					active = andNot(hitNow, active);
+					t = t + (d & active);
+					active = active & (t < float4(settings.maxDistance));
+				}
+
+				if (!any(hit)) continue;
+
+				// Tetrahedron gradient, 4 evaluations per packet
+				vec3x4 p = origin + dir * t;
+				const float h = 1e-3f;
+				float4 d0 = scene.evaluate({ p.x + float4(h), p.y - float4(h), p.z - float4(h) }).distance;
+				float4 d1 = scene.evaluate({ p.x - float4(h), p.y - float4(h), p.z + float4(h) }).distance;
+				float4 d2 = scene.evaluate({ p.x - float4(h), p.y + float4(h), p.z - float4(h) }).distance;
+				float4 d3 = scene.evaluate({ p.x + float4(h), p.y + float4(h), p.z + float4(h) }).distance;
+				vec3x4 n = { d0 - d1 - d2 + d3, -d0 - d1 + d2 + d3, -d0 + d1 - d2 + d3 };
+				float4 material = scene.evaluate(p).material;
+
+				int mask = movemask(hit);
+				for (int lane = 0; lane < 4; lane++) {
+					if (!(mask & (1 << lane))) continue;
+					Math::Vec3<float> normal = { n.x[lane], n.y[lane], n.z[lane] };
+					float len = normal.length();
+					if (len > 0) normal = normal * (1.f / len);
+					gbuffer.write(x + lane, y, t[lane], normal, static_cast<MaterialId>(material[lane]));
+				}
+			}
+		}
+	});
+}
@@ -0,0 +1,369 @@
+#pragma once
+
+#include "../Utils/Math.h"
+#include "../Utils/Vertex.h"
+#include "Renderer.h"
+#include "Deferred.h"
+#include "Camera.h"
+#include "LOD.h"
+#include "BVH.h"
+
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <cstdint>
+
+/*
+Scene container.
+
+Objects live in a BVH over their world bounds and every mesh keeps a second BVH over
+its meshlets (small clusters of triangles) in object space. Rendering culls the object
+tree against the camera, then the meshlets of the visible objects, and only then
+transforms vertices. Moving objects only refit the tree.
+*/
+
+struct Transform {
+
+	Math::Vec3<float> position;
+	float scale = 1.f;
+	float yaw = 0.f; // radians around Y
+
+	Math::Vec3<float> rotate(const Math::Vec3<float>& v) const {
+		float c = std::cos(yaw), s = std::sin(yaw);
+		return { c * v.x + s * v.z, v.y, -s * v.x + c * v.z };
+	}
+
+	Math::Vec3<float> inverseRotate(const Math::Vec3<float>& v) const {
+		float c = std::cos(yaw), s = std::sin(yaw);
+		return { c * v.x - s * v.z, v.y, s * v.x + c * v.z };
+	}
+
+	Math::Vec3<float> apply(const Math::Vec3<float>& p) const {
+		Math::Vec3<float> r = rotate(p);
+		return { r.x * scale + position.x, r.y * scale + position.y, r.z * scale + position.z };
+	}
+
+	Math::Vec3<float> inverse(const Math::Vec3<float>& p) const {
+		Math::Vec3<float> local = { (p.x - position.x) / scale, (p.y - position.y) / scale, (p.z - position.z) / scale };
+		return inverseRotate(local);
+	}
+
+	/* Conservative world box of a local box */
+	AABB apply(const AABB& box) const {
+		if (box.empty()) return box;
+		float c = std::abs(std::cos(yaw)), s = std::abs(std::sin(yaw));
+		Math::Vec3<float> center = apply(box.center());
+		Math::Vec3<float> e = box.extent();
+		Math::Vec3<float> r = { (c * e.x + s * e.z) * scale, e.y * scale, (s * e.x + c * e.z) * scale };
+		AABB out;
+		out.lo = { center.x - r.x, center.y - r.y, center.z - r.z };
+		out.hi = { center.x + r.x, center.y + r.y, center.z + r.z };
+		return out;
+	}
+
+	bool identity() const {
+		return scale == 1.f && yaw == 0.f && position.x == 0.f && position.y == 0.f && position.z == 0.f;
+	}
+
+};
+
+/* Orthographic view volume of a camera over a screen rectangle, everything behind the camera is culled */
+struct Frustum {
+
+	Math::Vec3<float> position, left, up, forward;
+	float uMin, uMax, vMin, vMax;
+
+	Frustum(const OrthographicCamera& camera, ScreenRect rect = {}) {
+		position = camera.getPosition();
+		left = camera.getLeft();
+		up = camera.getUp();
+		forward = camera.getForward();
+		float scale = camera.getScale();
+		Math::Vec2<float> center = camera.getScreenCenter();
+		uMin = (rect.x0 - center.u) / scale; uMax = (rect.x1 - center.u) / scale;
+		vMin = (rect.y0 - center.v) / scale; vMax = (rect.y1 - center.v) / scale;
+	}
+
+	CULL classify(const AABB& box) const {
+
+		Math::Vec3<float> c = box.center();
+		c = { c.x - position.x, c.y - position.y, c.z - position.z };
+		Math::Vec3<float> e = box.extent();
+		bool inside = true;
+
+		auto outside = [&](const Math::Vec3<float>& axis, float lo, float hi) {
+			float d = Math::dot(c, axis);
+			float r = std::abs(e.x * axis.x) + std::abs(e.y * axis.y) + std::abs(e.z * axis.z);
+			if (d + r < lo || d - r > hi) return true;
+			if (d - r < lo || d + r > hi) inside = false;
+			return false;
+		};
+
+		if (outside(left, uMin, uMax) || outside(up, vMin, vMax) || outside(forward, 0.f, 1e30f))
+			return CULL::OUTSIDE;
+		return inside ? CULL::INSIDE : CULL::INTERSECT;
+	}
+
+};
+
+struct Meshlet {
+	uint32_t firstVertex, vertexCount;
+	uint32_t firstIndex, indexCount; // indices are local to the meshlet vertices
+	AABB bounds;
+	uint32_t firstEdge = 0, edgeCount = 0; // index pairs, every edge of the level belongs to a single meshlet
+};
+
+struct MeshLevel {
+	std::vector<Vertex> vertices;
+	std::vector<Index> indices;
+	std::vector<Index> edges;
+	std::vector<Meshlet> meshlets;
+	BVH meshletTree;
+	float error = 0;
+};
+
+struct Mesh {
+
+	static constexpr uint32_t MESHLET_TRIANGLES = 64;
+
+	std::vector<MeshLevel> levels;
+	AABB bounds;
+
+	Mesh(const std::vector<Vertex>& vertices, const std::vector<Index>& indices) {
+		addLevel(vertices, indices, 0.f);
+	}
+
+	Mesh(const LODChain& chain) {
+		for (const LODLevel& level : chain.levels) addLevel(level.vertices, level.indices, level.error);
+	}
+
+	/* Same rule as LODChain::select, cellsPerUnit already includes the object scale */
+	const MeshLevel& select(float cellsPerUnit, float maxCellError = .5f) const {
+		size_t best = 0;
+		for (size_t l = 1; l < levels.size(); l++)
+			if (levels[l].error * cellsPerUnit <= maxCellError) best = l;
+		return levels[best];
+	}
+
+private:
+
+	/* Greedy clustering in index order, every meshlet gets its own copy of the vertices it uses */
+	void addLevel(const std::vector<Vertex>& vertices, const std::vector<Index>& indices, float error) {
+
+		MeshLevel& level = levels.emplace_back();
+		level.error = error;
+
+		std::vector<Index> remap(vertices.size(), static_cast<Index>(-1));
+		std::vector<Index> used;
+
+		for (size_t t = 0; t + 2 < indices.size();) {
+
+			Meshlet m = { static_cast<uint32_t>(level.vertices.size()), 0, static_cast<uint32_t>(level.indices.size()), 0, AABB{} };
+
+			for (uint32_t n = 0; n < MESHLET_TRIANGLES && t + 2 < indices.size(); n++, t += 3) {
+				for (int k = 0; k < 3; k++) {
+					Index v = indices[t + k];
+					if (remap[v] == static_cast<Index>(-1)) {
+						remap[v] = m.vertexCount++;
+						used.push_back(v);
+						level.vertices.push_back(vertices[v]);
+						m.bounds.expand(vertices[v].position);
+					}
+					level.indices.push_back(remap[v]);
+				}
+			}
+
+			m.indexCount = static_cast<uint32_t>(level.indices.size()) - m.firstIndex;
+			for (Index v : used) remap[v] = static_cast<Index>(-1);
+			used.clear();
+
+			bounds.expand(m.bounds);
+			level.meshlets.push_back(m);
+		}
+
+		// Edges of the whole level, each one owned by the meshlet of the first triangle using it.
+		// level.indices follows the source triangle order, so a corner maps to its local index as is
+		std::vector<uint32_t> corners;
+		extractEdgeCorners(indices.data(), level.indices.size(), corners);
+		size_t next = 0;
+		for (Meshlet& m : level.meshlets) {
+			m.firstEdge = static_cast<uint32_t>(level.edges.size());
+			for (; next < corners.size() && corners[next] < m.firstIndex + m.indexCount; next++) {
+				level.edges.push_back(level.indices[corners[next]]);
+				level.edges.push_back(level.indices[nextCorner(corners[next])]);
+			}
+			m.edgeCount = static_cast<uint32_t>(level.edges.size()) - m.firstEdge;
+		}
+
+		std::vector<AABB> boxes;
+		for (const Meshlet& m : level.meshlets) boxes.push_back(m.bounds);
+		level.meshletTree.build(boxes);
+	}
+
+};
+
+typedef uint32_t ObjectId;
+
+class Scene {
+
+public:
+
+	struct Object {
+		std::shared_ptr<const Mesh> mesh;
+		Transform transform;
+		MaterialId material = 0;
+		AABB bounds; // world space
+		uint32_t version = 0; // bumped on every change, see DirtyTiles
+	};
+
+	ObjectId add(std::shared_ptr<const Mesh> mesh, const Transform& transform = {}, MaterialId material = 0) {
+		objects.push_back({ std::move(mesh), transform, material, AABB{}, 0 });
+		objects.back().bounds = transform.apply(objects.back().mesh->bounds);
+		boxes.push_back(objects.back().bounds);
+		needsRebuild = true;
+		return static_cast<ObjectId>(objects.size() - 1);
+	}
+
+	void setTransform(ObjectId id, const Transform& transform) {
+		Object& o = objects[id];
+		o.transform = transform;
+		o.bounds = boxes[id] = transform.apply(o.mesh->bounds);
+		o.version++;
+		needsRefit = true;
+	}
+
+	const Object& get(ObjectId id) const { return objects[id]; }
+	size_t size() const { return objects.size(); }
+
+	/* Brings the BVH up to date, call once per frame after moving objects */
+	void update() {
+		if (needsRebuild) {
+			bvh.build(boxes);
+		}
+		else if (needsRefit) {
+			bvh.refit(boxes);
+			if (bvh.degraded()) bvh.build(boxes);
+		}
+		needsRebuild = needsRefit = false;
+	}
+
+	/* Appends the objects intersecting the view volume of rect */
+	void cull(const OrthographicCamera& camera, std::vector<ObjectId>& out, ScreenRect rect = {}) const {
+		Frustum frustum(camera, rect);
+		bvh.cull([&](const AABB& b) { return frustum.classify(b); }, [&](uint32_t id) { out.push_back(id); });
+	}
+
+	/* Object under the terminal cell (x, y), -1 when nothing is there */
+	int pick(const OrthographicCamera& camera, int x, int y, float* distance = nullptr) const {
+
+		float halfCell = .5f / camera.getScale();
+		Math::Vec3<float> origin = camera.toWorldCoords({ x, y }, 0.f)
+			+ camera.getLeft() * halfCell + camera.getUp() * halfCell;
+		Math::Vec3<float> dir = camera.getForward();
+
+		float t;
+		int hit = bvh.raycast(origin, dir, [&](uint32_t id, float maxT) {
+			return raycastObject(objects[id], origin, dir, maxT);
+		}, t);
+
+		if (distance) *distance = t;
+		return hit;
+	}
+
+	/* draw(object, level, meshlet) for every meshlet left after culling */
+	template<typename Draw>
+	void forEachVisibleMeshlet(const OrthographicCamera& camera, ScreenRect rect, Draw&& draw) const {
+
+		Frustum frustum(camera, rect);
+
+		bvh.cull([&](const AABB& b) { return frustum.classify(b); }, [&](uint32_t id) {
+			const Object& o = objects[id];
+			const MeshLevel& level = o.mesh->select(camera.getScale() * o.transform.scale);
+			level.meshletTree.cull(
+				[&](const AABB& b) { return frustum.classify(o.transform.apply(b)); },
+				[&](uint32_t m) { draw(o, level, level.meshlets[m]); });
+		});
+	}
+
+	void render(char* buffer, const OrthographicCamera& camera, RENDER_MODE mode = RENDER_MODE::FILLED, ScreenRect rect = {}) const {
+		forEachVisibleMeshlet(camera, rect, [&](const Object& o, const MeshLevel& level, const Meshlet& m) {
+			const Vertex* vertices = transformed(o, level, m);
+			renderTriangles(buffer, camera, vertices, level.indices.data() + m.firstIndex, m.indexCount, mode, rect,
+				level.edges.data() + m.firstEdge, m.edgeCount);
+		});
+	}
+
+	void renderDeferred(GBuffer& gbuffer, const OrthographicCamera& camera, ScreenRect rect = {}) const {
+		forEachVisibleMeshlet(camera, rect, [&](const Object& o, const MeshLevel& level, const Meshlet& m) {
+			const Vertex* vertices = transformed(o, level, m);
+			renderTrianglesDeferred(gbuffer, camera, vertices, level.indices.data() + m.firstIndex, m.indexCount, o.material, rect);
+		});
+	}
+
+private:
+
+	/* World space vertices of a meshlet, points straight into the mesh for untransformed objects */
+	const Vertex* transformed(const Object& o, const MeshLevel& level, const Meshlet& m) const {
+		const Vertex* source = level.vertices.data() + m.firstVertex;
+		if (o.transform.identity()) return source;
+
+		thread_local std::vector<Vertex> scratch;
+		scratch.resize(m.vertexCount);
+		for (uint32_t i = 0; i < m.vertexCount; i++) {
+			scratch[i].position = o.transform.apply(source[i].position);
+			scratch[i].normal = o.transform.rotate(source[i].normal);
+		}
+		return scratch.data();
+	}
+
+	/* Ray against the full resolution triangles, in object space so the meshlet tree can be reused */
+	static float raycastObject(const Object& o, const Math::Vec3<float>& origin, const Math::Vec3<float>& dir, float maxT) {
+
+		// p = origin + t * dir maps linearly to object space, t is unchanged
+		Math::Vec3<float> localOrigin = o.transform.inverse(origin);
+		Math::Vec3<float> localDir = o.transform.inverseRotate(dir);
+		localDir = { localDir.x / o.transform.scale, localDir.y / o.transform.scale, localDir.z / o.transform.scale };
+
+		const MeshLevel& level = o.mesh->levels[0];
+		float t;
+		int hit = level.meshletTree.raycast(localOrigin, localDir, [&](uint32_t id, float limit) {
+			const Meshlet& m = level.meshlets[id];
+			const Vertex* v = level.vertices.data() + m.firstVertex;
+			const Index* idx = level.indices.data() + m.firstIndex;
+			float best = -1.f;
+			for (uint32_t i = 0; i + 2 < m.indexCount; i += 3) {
+				float d = intersectTriangle(localOrigin, localDir, v[idx[i]].position, v[idx[i + 1]].position, v[idx[i + 2]].position);
+				if (d >= 0 && d < limit && (best < 0 || d < best)) best = d;
+			}
+			return best;
+		}, t);
+
+		return (hit >= 0 && t < maxT) ? t : -1.f;
+	}
+
+	/* Moller-Trumbore, double sided */
+	static float intersectTriangle(Math::Vec3<float> o, Math::Vec3<float> d,
+		Math::Vec3<float> a, Math::Vec3<float> b, Math::Vec3<float> c)
+	{
+		Math::Vec3<float> e1 = b - a, e2 = c - a;
+		Math::Vec3<float> p = Math::cross(d, e2);
+		float det = Math::dot(e1, p);
+		if (std::abs(det) < 1e-12f) return -1.f;
+		float inv = 1.f / det;
+		Math::Vec3<float> s = o - a;
+		float u = Math::dot(s, p) * inv;
+		if (u < 0.f || u > 1.f) return -1.f;
+		Math::Vec3<float> q = Math::cross(s, e1);
+		float v = Math::dot(d, q) * inv;
+		if (v < 0.f || u + v > 1.f) return -1.f;
+		float t = Math::dot(e2, q) * inv;
+		return (t >= 0.f) ? t : -1.f;
+	}
+
+	std::vector<Object> objects;
+	std::vector<AABB> boxes;
+	BVH bvh;
+	bool needsRebuild = false;
+	bool needsRefit = false;
+
+};
@@ -0,0 +1,283 @@
+#pragma once
+
+#include "../Utils/Math.h"
+#include "../Utils/Vertex.h"
+#include "../Utils/Noise.h"
+#include "Renderer.h"
+
+#include <vector>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cmath>
+
+/*
+Chunked heightmap terrain.
+
+Chunks are generated (noise + meshing of every LOD) on background threads, the render
+thread only integrates finished chunks in update() and never waits for them. Chunks that
+are not ready yet are simply not drawn this frame.
+*/
+
+struct TerrainSettings {
+	int chunkResolution = 32;	// quads per side at LOD 0, must be divisible by 2^(lodCount-1)
+	float chunkSize = 8.f;		// world units per side
+	float heightScale = 2.f;
+	float skirtDepth = .5f;		// hides the cracks between chunks of different LOD
+	FBMParams noise{ 5, .08f };
+	int lodCount = 4;
+	float lodDistance = 10.f;	// every lodDistance units from the center drops one LOD
+	int viewRadius = 3;			// in chunks around the center
+	size_t cacheSize = 128;		// chunks kept in memory, least recently used are evicted first
+	int workers = 2;
+};
+
+struct ChunkCoord {
+	int x, z;
+	bool operator==(const ChunkCoord& rhs) const { return x == rhs.x && z == rhs.z; }
+};
+
+struct ChunkCoordHash {
+	size_t operator()(const ChunkCoord& c) const {
+		return std::hash<long long>()((static_cast<long long>(c.x) << 32) ^ static_cast<unsigned int>(c.z));
+	}
+};
+
+struct TerrainMesh {
+	std::vector<Vertex> vertices;
+	std::vector<Index> indices;
+	std::vector<Index> edges; // unique edges as index pairs, for the line modes
+};
+
+struct TerrainChunk {
+	ChunkCoord coord;
+	std::vector<TerrainMesh> lods; // lods[0] is the full resolution mesh
+};
+
+class Terrain {
+
+public:
+
+	struct VisibleChunk {
+		std::shared_ptr<const TerrainChunk> chunk;
+		int lod;
+		const TerrainMesh& mesh() const { return chunk->lods[lod]; }
+	};
+
+	Terrain(TerrainSettings s = {}) : settings(s) {
+		int side = 2 * settings.viewRadius + 1;
+		settings.cacheSize = (std::max)(settings.cacheSize, static_cast<size_t>(side * side));
+		for (int i = 0; i < (std::max)(1, settings.workers); i++)
+			workers.emplace_back([this]() { workerLoop(); });
+	}
+
+	~Terrain() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wakeUp.notify_all();
+		for (std::thread& t : workers) t.join();
+	}
+
+	Terrain(const Terrain&) = delete;
+	Terrain& operator=(const Terrain&) = delete;
+
+	/* Integrates finished chunks, requests the missing ones around center and picks the LODs */
+	void update(Math::Vec3<float> center) {
+
+		ChunkCoord centerChunk = {
+			static_cast<int>(std::floor(center.x / settings.chunkSize)),
+			static_cast<int>(std::floor(center.z / settings.chunkSize))
+		};
+		auto inRange = [&](ChunkCoord c) {
+			return std::abs(c.x - centerChunk.x) <= settings.viewRadius && std::abs(c.z - centerChunk.z) <= settings.viewRadius;
+		};
+
+		std::vector<std::shared_ptr<TerrainChunk>> done;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			done.swap(finished);
+
+			// Jobs that did not start yet and went out of range are dropped
+			for (auto it = requests.begin(); it != requests.end();) {
+				if (inRange(*it)) { ++it; continue; }
+				pending.erase(*it);
+				it = requests.erase(it);
+			}
+		}
+		for (auto& chunk : done) {
+			pending.erase(chunk->coord);
+			insert(chunk);
+		}
+
+		m_visible.clear();
+		std::vector<ChunkCoord> missing;
+
+		for (int dz = -settings.viewRadius; dz <= settings.viewRadius; dz++) {
+			for (int dx = -settings.viewRadius; dx <= settings.viewRadius; dx++) {
+
+				ChunkCoord c = { centerChunk.x + dx, centerChunk.z + dz };
+				auto it = cache.find(c);
+
+				if (it == cache.end()) {
+					if (!pending.count(c)) missing.push_back(c);
+					continue;
+				}
+
+				// Touch
+				lru.splice(lru.begin(), lru, it->second.second);
+
+				float cx = (c.x + .5f) * settings.chunkSize - center.x;
+				float cz = (c.z + .5f) * settings.chunkSize - center.z;
+				int lod = static_cast<int>(std::sqrt(cx * cx + cz * cz) / settings.lodDistance);
+				m_visible.push_back({ it->second.first, (std::min)(lod, settings.lodCount - 1) });
+			}
+		}
+
+		if (missing.empty()) return;
+
+		// Closest chunks first
+		std::sort(missing.begin(), missing.end(), [&](ChunkCoord a, ChunkCoord b) {
+			return (a.x - centerChunk.x) * (a.x - centerChunk.x) + (a.z - centerChunk.z) * (a.z - centerChunk.z)
+				< (b.x - centerChunk.x) * (b.x - centerChunk.x) + (b.z - centerChunk.z) * (b.z - centerChunk.z);
+		});
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (ChunkCoord c : missing) {
+				pending.insert(c);
+				requests.push_back(c);
+			}
+		}
+		wakeUp.notify_all();
+	}
+
+	const std::vector<VisibleChunk>& visible() const { return m_visible; }
+
+	/* Synchronous generation, used by the workers */
+	static std::shared_ptr<TerrainChunk> generateChunk(ChunkCoord coord, const TerrainSettings& settings) {
+
+		auto chunk = std::make_shared<TerrainChunk>();
+		chunk->coord = coord;
+
+		const int res = settings.chunkResolution;
+		const int side = res + 3; // one sample of apron on each side for the normals
+		const float step = settings.chunkSize / res;
+		const float originX = coord.x * settings.chunkSize;
+		const float originZ = coord.z * settings.chunkSize;
+
+		std::vector<float> heights(side * side);
+		for (int j = 0; j < side; j++) {
+			float* row = heights.data() + j * side;
+			Noise::fbmRow(row, side, originX - step, originZ + (j - 1) * step, step, settings.noise);
+			for (int i = 0; i < side; i++) row[i] *= settings.heightScale;
+		}
+		auto heightAt = [&](int i, int j) { return heights[(j + 1) * side + (i + 1)]; };
+
+		for (int lod = 0; lod < settings.lodCount; lod++) {
+
+			const int stride = 1 << lod;
+			const int count = res / stride + 1;
+			TerrainMesh& mesh = chunk->lods.emplace_back();
+			mesh.vertices.reserve(count * count + 4 * count);
+			mesh.indices.reserve((count - 1) * (count - 1) * 6 + 4 * (count - 1) * 6);
+
+			for (int j = 0; j <= res; j += stride) {
+				for (int i = 0; i <= res; i += stride) {
+					Math::Vec3<float> normal = {
+						(heightAt(i - 1, j) - heightAt(i + 1, j)) / (2.f * step),
+						1.f,
+						(heightAt(i, j - 1) - heightAt(i, j + 1)) / (2.f * step)
+					};
+					mesh.vertices.push_back({ { originX + i * step, heightAt(i, j), originZ + j * step }, normal.normalize() });
+				}
+			}
+
+			for (int j = 0; j + 1 < count; j++) {
+				for (int i = 0; i + 1 < count; i++) {
+					Index a = j * count + i, b = a + 1, c = a + count, d = c + 1;
+					mesh.indices.insert(mesh.indices.end(), { a, c, b, b, c, d });
+				}
+			}
+
+			// Skirts, a strip hanging below each border
+			auto addSkirt = [&](Index first, int offset) {
+				Index base = static_cast<Index>(mesh.vertices.size());
+				for (int k = 0; k < count; k++) {
+					Vertex v = mesh.vertices[first + k * offset];
+					v.position.y -= settings.skirtDepth;
+					mesh.vertices.push_back(v);
+				}
+				for (int k = 0; k + 1 < count; k++) {
+					Index top = first + k * offset, nextTop = first + (k + 1) * offset;
+					mesh.indices.insert(mesh.indices.end(), { top, base + k, nextTop, nextTop, base + k, base + k + 1 });
+				}
+			};
+			addSkirt(0, 1);									// z min
+			addSkirt((count - 1) * count, 1);				// z max
+			addSkirt(0, count);								// x min
+			addSkirt(count - 1, count);						// x max
+
+			extractEdges(mesh.indices.data(), mesh.indices.size(), mesh.edges);
+		}
+
+		return chunk;
+	}
+
+private:
+
+	void insert(std::shared_ptr<const TerrainChunk> chunk) {
+
+		lru.push_front(chunk->coord);
+		cache[chunk->coord] = { chunk, lru.begin() };
+
+		while (cache.size() > settings.cacheSize) {
+			cache.erase(lru.back());
+			lru.pop_back();
+		}
+	}
+
+	void workerLoop() {
+
+		while (true) {
+
+			ChunkCoord coord;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeUp.wait(lock, [this]() { return stopping || !requests.empty(); });
+				if (stopping) return;
+				coord = requests.front();
+				requests.pop_front();
+			}
+
+			auto chunk = generateChunk(coord, settings);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			finished.push_back(std::move(chunk));
+		}
+	}
+
+	TerrainSettings settings;
+
+	// Render thread only
+	std::unordered_map<ChunkCoord, std::pair<std::shared_ptr<const TerrainChunk>, std::list<ChunkCoord>::iterator>, ChunkCoordHash> cache;
+	std::list<ChunkCoord> lru;
+	std::unordered_set<ChunkCoord, ChunkCoordHash> pending; // requested, not integrated yet
+	std::vector<VisibleChunk> m_visible;
+
+	// Shared with the workers, guarded by mutex
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	std::deque<ChunkCoord> requests;
+	std::vector<std::shared_ptr<TerrainChunk>> finished;
+	bool stopping = false;
+
+	std::vector<std::thread> workers;
+
+};
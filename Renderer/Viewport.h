@@ -0,0 +1,241 @@
+#pragma once
+
+#include "../Utils/Math.h"
+#include "../Utils/Vertex.h"
+#include "../Utils/ParallelFor.h"
+#include "Renderer.h"
+#include "Camera.h"
+#include "Scene.h"
+
+#include <vector>
+#include <cstdint>
+
+/*
+Several cameras in one frame.
+
+A viewport is a camera drawn into a rectangle of the framebuffer, with its projection centered
+on that rectangle. Every viewport shares the framebuffer and the depth buffer (dp).
+ViewportCache::build culls the scene for every viewport, then does the camera-independent
+work once per frame: it transforms the meshlets that at least one viewport sees into world
+space and shades their faces, since the sun is fixed. Each viewport then only projects and
+rasterizes its own list of meshlets. The rectangles do not overlap, so the viewports are
+drawn in parallel.
+*/
+
+struct Viewport {
+	ScreenRect rect;
+	OrthographicCamera camera;
+	RENDER_MODE mode = RENDER_MODE::FILLED;
+
+	/* The camera with its projection centered on rect, use it to pick or to draw over the viewport */
+	OrthographicCamera centered() const {
+		OrthographicCamera c = camera;
+		c.setScreenCenter({ (rect.x0 + rect.x1) * .5f, (rect.y0 + rect.y1) * .5f });
+		return c;
+	}
+
+	bool contains(int x, int y) const { return x >= rect.x0 && x < rect.x1 && y >= rect.y0 && y < rect.y1; }
+};
+
+/* columns x rows rectangles tiling area, separated by gap cells */
+std::vector<ScreenRect> splitScreen(int columns, int rows, int gap = 1, ScreenRect area = {}) {
+
+	std::vector<ScreenRect> rects;
+	int w = area.x1 - area.x0 + gap, h = area.y1 - area.y0 + gap;
+	for (int r = 0; r < rows; r++)
+		for (int c = 0; c < columns; c++)
+			rects.push_back({
+				area.x0 + w * c / columns, area.y0 + h * r / rows,
+				area.x0 + w * (c + 1) / columns - gap, area.y0 + h * (r + 1) / rows - gap
+			});
+	return rects;
+}
+
+/* Index of the viewport under the cell (x, y), -1 when none */
+int viewportAt(const std::vector<Viewport>& viewports, int x, int y) {
+	for (size_t i = 0; i < viewports.size(); i++)
+		if (viewports[i].contains(x, y)) return static_cast<int>(i);
+	return -1;
+}
+
+class ViewportCache {
+
+public:
+
+	/*
+	Culls the scene for every viewport, then transforms and shades the meshlets that at least
+	one of them sees. The level of detail of an object is the finest that any viewport seeing
+	it needs.
+	*/
+	void build(const Scene& scene, const std::vector<Viewport>& viewports, int meshletsPerTask = 8) {
+
+		objects.assign(scene.size(), {});
+		meshlets.clear();
+		visible.resize(viewports.size());
+
+		// -- Objects, and the finest scale they are seen at
+
+		std::vector<std::vector<ObjectId>> ids(viewports.size());
+		std::vector<float> finest(scene.size(), 0.f);
+		for (size_t v = 0; v < viewports.size(); v++) {
+			scene.cull(viewports[v].centered(), ids[v], viewports[v].rect);
+			for (ObjectId id : ids[v]) finest[id] = (std::max)(finest[id], viewports[v].camera.getScale());
+		}
+
+		for (ObjectId id = 0; id < scene.size(); id++) {
+			if (finest[id] == 0.f) continue;
+			const Scene::Object& o = scene.get(id);
+			const MeshLevel& level = o.mesh->select(finest[id] * o.transform.scale);
+			objects[id] = { &level, static_cast<uint32_t>(meshlets.size()) };
+			meshlets.resize(meshlets.size() + level.meshlets.size(), { id, UNUSED, 0 });
+		}
+
+		// -- Meshlets, culled per viewport at that level
+
+		for (size_t v = 0; v < viewports.size(); v++) {
+			visible[v].clear();
+			Frustum frustum(viewports[v].centered(), viewports[v].rect);
+			for (ObjectId id : ids[v]) {
+				const Scene::Object& o = scene.get(id);
+				const CachedObject& co = objects[id];
+				co.level->meshletTree.cull(
+					[&](const AABB& b) { return frustum.classify(o.transform.apply(b)); },
+					[&](uint32_t m) {
+						visible[v].push_back(co.firstMeshlet + m);
+						meshlets[co.firstMeshlet + m].firstVertex = 0; // seen, laid out below
+					});
+			}
+		}
+
+		used.clear();
+		uint32_t vertexCount = 0, faceCount = 0;
+		for (uint32_t slot = 0; slot < meshlets.size(); slot++) {
+			CachedMeshlet& c = meshlets[slot];
+			if (c.firstVertex == UNUSED) continue;
+			const Meshlet& m = meshlet(slot);
+			c.firstVertex = vertexCount;
+			c.firstFace = faceCount;
+			vertexCount += m.vertexCount;
+			faceCount += m.indexCount / 3;
+			used.push_back(slot);
+		}
+		vertices.resize(vertexCount);
+		faces.resize(faceCount);
+
+		// -- World transform and shading, shared by every viewport
+
+		parallelFor(0, static_cast<int>(used.size()), meshletsPerTask, [&](int first, int last) {
+			for (int i = first; i < last; i++) {
+				const CachedMeshlet& c = meshlets[used[i]];
+				const Scene::Object& o = scene.get(c.object);
+				const MeshLevel& level = *objects[c.object].level;
+				const Meshlet& m = meshlet(used[i]);
+
+				const Vertex* source = level.vertices.data() + m.firstVertex;
+				Vertex* world = vertices.data() + c.firstVertex;
+				for (uint32_t n = 0; n < m.vertexCount; n++) {
+					world[n].position = o.transform.apply(source[n].position);
+					world[n].normal = o.transform.rotate(source[n].normal);
+				}
+
+				const Index* idx = level.indices.data() + m.firstIndex;
+				for (uint32_t t = 0; t + 2 < m.indexCount; t += 3)
+					faces[c.firstFace + t / 3] = shadeFace({ world[idx[t]].normal, world[idx[t + 1]].normal, world[idx[t + 2]].normal });
+			}
+		});
+	}
+
+	/* Clears and draws every viewport given to the last build, one task per viewport, the cells between them are cleared too */
+	void render(char* buffer, const std::vector<Viewport>& viewports, bool hasColors = true) const {
+		clearGaps(buffer, viewports, hasColors);
+		parallelFor(0, static_cast<int>(viewports.size()), 1, [&](int first, int last) {
+			for (int v = first; v < last; v++) renderViewport(buffer, viewports[v], visible[v], hasColors);
+		});
+	}
+
+	size_t vertexCount() const { return vertices.size(); }
+	size_t faceCount() const { return faces.size(); }
+
+private:
+
+	static constexpr uint32_t UNUSED = 0xFFFFFFFF;
+
+	struct CachedObject {
+		const MeshLevel* level = nullptr; // null when no viewport sees the object
+		uint32_t firstMeshlet = 0;
+	};
+
+	struct CachedMeshlet {
+		ObjectId object;
+		uint32_t firstVertex, firstFace; // firstVertex is UNUSED when no viewport sees the meshlet
+	};
+
+	const Meshlet& meshlet(uint32_t slot) const {
+		const CachedObject& co = objects[meshlets[slot].object];
+		return co.level->meshlets[slot - co.firstMeshlet];
+	}
+
+	/* Cells outside every viewport get the clear glyph, nothing else ever writes them */
+	static void clearGaps(char* buffer, const std::vector<Viewport>& viewports, bool hasColors) {
+		for (int y = 0; y < SCREEN_HEIGHT; y++)
+			for (int x = 0; x < SCREEN_WIDTH; x++) {
+				if (viewportAt(viewports, x, y) >= 0) continue;
+				if (hasColors) clearCell(buffer, SCREEN_WIDTH, x, y);
+				else buffer[y * SCREEN_WIDTH + x] = '.';
+			}
+	}
+
+	void renderViewport(char* buffer, const Viewport& viewport, const std::vector<uint32_t>& slots, bool hasColors) const {
+
+		const ScreenRect rect = viewport.rect;
+		const OrthographicCamera camera = viewport.centered();
+		clearScreenRect(buffer, rect, hasColors);
+		dp.clear(rect.x0, rect.y0, rect.x1, rect.y1);
+
+		for (uint32_t slot : slots) renderMeshlet(buffer, camera, viewport.mode, rect, slot);
+	}
+
+	/* Projects the meshlet vertices once, then its faces and edges */
+	void renderMeshlet(char* buffer, const OrthographicCamera& camera, RENDER_MODE mode, ScreenRect rect, uint32_t slot) const
+	{
+		const CachedMeshlet& c = meshlets[slot];
+		const MeshLevel& level = *objects[c.object].level;
+		const Meshlet& m = meshlet(slot);
+		const Vertex* world = vertices.data() + c.firstVertex;
+
+		Math::Vec3<float> camForward = camera.getForward();
+		float camDepth = dot(camera.getPosition(), camForward);
+
+		thread_local std::vector<Math::uVec2> points;
+		thread_local std::vector<float> depths;
+		points.resize(m.vertexCount);
+		depths.resize(m.vertexCount);
+		for (uint32_t n = 0; n < m.vertexCount; n++) {
+			points[n] = camera.toScreenCoords(camera.toCamCoords(world[n].position));
+			depths[n] = dot(world[n].position, camForward) - camDepth;
+		}
+
+		const Index* idx = level.indices.data() + m.firstIndex;
+		for (uint32_t t = 0; mode != RENDER_MODE::WIREFRAME && t + 2 < m.indexCount; t += 3) {
+			Index a = idx[t], b = idx[t + 1], d = idx[t + 2];
+			Math::Vec3<float> z = { depths[a], depths[b], depths[d] };
+			(mode == RENDER_MODE::HIDDEN_LINE) ?
+				drawMaskTriangle(buffer, SCREEN_WIDTH, points[a], points[b], points[d], z, rect) :
+				drawShadedTriangle(buffer, SCREEN_WIDTH, points[a], points[b], points[d], faces[c.firstFace + t / 3], z, rect);
+		}
+
+		if (mode == RENDER_MODE::FILLED) return;
+
+		const Index* edges = level.edges.data() + m.firstEdge;
+		for (uint32_t e = 0; e + 1 < m.edgeCount; e += 2)
+			drawLine(buffer, SCREEN_WIDTH, points[edges[e]], points[edges[e + 1]], depths[edges[e]], depths[edges[e + 1]], COLOR::white, rect);
+	}
+
+	std::vector<CachedObject> objects;				// by ObjectId
+	std::vector<CachedMeshlet> meshlets;
+	std::vector<Vertex> vertices;					// world space
+	std::vector<FaceShade> faces;					// one per triangle
+	std::vector<uint32_t> used;						// meshlets seen by at least one viewport
+	std::vector<std::vector<uint32_t>> visible;		// per viewport, meshlets left after culling
+
+};
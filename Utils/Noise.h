@@ -1,6 +1,161 @@
 #pragma once
 
+#include "SIMD.h"
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+
+/*
+2D gradient (Perlin) noise and fBm.
+The lattice hash is arithmetic instead of a permutation table so whole rows can be
+evaluated 4 samples at a time, the scalar and row versions return the same values.
+*/
+struct FBMParams {
+	int octaves = 5;
+	float frequency = 1.f;
+	float lacunarity = 2.f;
+	float gain = .5f;
+	uint32_t seed = 0;
+};
+
 class Noise {
 
-	static float perlinNoise(int x, int y);
-};
\ No newline at end of file
+public:
+
+	/* Roughly in [-1, 1] */
+	static float perlinNoise(float x, float y, uint32_t seed = 0) {
+
+		float fx0 = std::floor(x), fy0 = std::floor(y);
+		int32_t x0 = static_cast<int32_t>(fx0), y0 = static_cast<int32_t>(fy0);
+		float dx = x - fx0, dy = y - fy0;
+
+		float n00 = grad(hash(x0, y0, seed), dx, dy);
+		float n10 = grad(hash(x0 + 1, y0, seed), dx - 1.f, dy);
+		float n01 = grad(hash(x0, y0 + 1, seed), dx, dy - 1.f);
+		float n11 = grad(hash(x0 + 1, y0 + 1, seed), dx - 1.f, dy - 1.f);
+
+		float u = fade(dx), v = fade(dy);
+		float nx0 = n00 + (n10 - n00) * u;
+		float nx1 = n01 + (n11 - n01) * u;
+		return nx0 + (nx1 - nx0) * v;
+	}
+
+	/* out[i] = perlinNoise(x + i * step, y) for i in [0, count[ */
+	static void perlinRow(float* out, int count, float x, float y, float step, uint32_t seed = 0) {
+
+		using namespace SIMD;
+
+		float fy0 = std::floor(y);
+		int4 y0 = static_cast<int32_t>(fy0);
+		float4 dy = y - fy0;
+		float4 v = fade(dy);
+		int4 s = static_cast<int32_t>(seed);
+
+		int i = 0;
+		for (; i + 4 <= count; i += 4) {
+
+			float4 xs = float4(x) + float4::ramp(static_cast<float>(i), 1.f) * float4(step);
+			int4 x0 = floorToInt(xs);
+			float4 dx = xs - toFloat(x0);
+
+			float4 n00 = grad(hash(x0, y0, s), dx, dy);
+			float4 n10 = grad(hash(x0 + 1, y0, s), dx - 1.f, dy);
+			float4 n01 = grad(hash(x0, y0 + 1, s), dx, dy - 1.f);
+			float4 n11 = grad(hash(x0 + 1, y0 + 1, s), dx - 1.f, dy - 1.f);
+
+			float4 u = fade(dx);
+			float4 nx0 = n00 + (n10 - n00) * u;
+			float4 nx1 = n01 + (n11 - n01) * u;
+			(nx0 + (nx1 - nx0) * v).store(out + i);
+		}
+		for (; i < count; i++)
+			out[i] = perlinNoise(x + static_cast<float>(i) * step, y, seed);
+	}
+
+	/* Fractal sum of perlin octaves, normalized back to roughly [-1, 1] */
+	static float fbm(float x, float y, const FBMParams& params = {}) {
+		float sum = 0, amplitude = 1, norm = 0, frequency = params.frequency;
+		for (int o = 0; o < params.octaves; o++) {
+			sum += amplitude * perlinNoise(x * frequency, y * frequency, params.seed + o);
+			norm += amplitude;
+			amplitude *= params.gain;
+			frequency *= params.lacunarity;
+		}
+		return (norm > 0) ? sum / norm : 0.f;
+	}
+
+	/* out[i] = fbm(x + i * step, y) for i in [0, count[ */
+	static void fbmRow(float* out, int count, float x, float y, float step, const FBMParams& params = {}) {
+
+		using namespace SIMD;
+
+		thread_local std::vector<float> octave;
+		octave.resize(count);
+		std::fill(out, out + count, 0.f);
+
+		float amplitude = 1, norm = 0, frequency = params.frequency;
+		for (int o = 0; o < params.octaves; o++) {
+
+			perlinRow(octave.data(), count, x * frequency, y * frequency, step * frequency, params.seed + o);
+
+			int i = 0;
+			for (; i + 4 <= count; i += 4)
+				(float4::load(out + i) + float4::load(octave.data() + i) * float4(amplitude)).store(out + i);
+			for (; i < count; i++)
+				out[i] += octave[i] * amplitude;
+
+			norm += amplitude;
+			amplitude *= params.gain;
+			frequency *= params.lacunarity;
+		}
+
+		if (norm > 0) {
+			int i = 0;
+			for (; i + 4 <= count; i += 4)
+				(float4::load(out + i) * float4(1.f / norm)).store(out + i);
+			for (; i < count; i++)
+				out[i] *= 1.f / norm;
+		}
+	}
+
+private:
+
+	static uint32_t hash(int32_t x, int32_t y, uint32_t seed) {
+		uint32_t h = static_cast<uint32_t>(x) * 0x27d4eb2du ^ static_cast<uint32_t>(y) * 0x165667b1u ^ seed * 0x9e3779b9u;
+		h ^= h >> 15;
+		h *= 0x2c1b3c6du;
+		h ^= h >> 12;
+		return h;
+	}
+
+	static SIMD::int4 hash(SIMD::int4 x, SIMD::int4 y, SIMD::int4 seed) {
+		using namespace SIMD;
+		int4 h = x * int4(0x27d4eb2d) ^ y * int4(0x165667b1) ^ seed * int4(static_cast<int32_t>(0x9e3779b9u));
+		h = h ^ (h >> 15);
+		h = h * int4(0x2c1b3c6d);
+		h = h ^ (h >> 12);
+		return h;
+	}
+
+	/* One of the 4 diagonal gradients, picked by the two low bits of the hash */
+	static float grad(uint32_t h, float x, float y) {
+		return ((h & 1) ? -x : x) + ((h & 2) ? -y : y);
+	}
+
+	static SIMD::float4 grad(SIMD::int4 h, SIMD::float4 x, SIMD::float4 y) {
+		using namespace SIMD;
+		// move bit 0 / bit 1 into the sign bit and flip
+		float4 signX = asFloat((h & int4(1)) << 31);
+		float4 signY = asFloat((h & int4(2)) << 30);
+		return (x ^ signX) + (y ^ signY);
+	}
+
+	static float fade(float t) { return t * t * t * (t * (t * 6.f - 15.f) + 10.f); }
+
+	static SIMD::float4 fade(SIMD::float4 t) {
+		using namespace SIMD;
+		return t * t * t * (t * (t * float4(6.f) - float4(15.f)) + float4(10.f));
+	}
+
+};
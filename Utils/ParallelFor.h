@@ -0,0 +1,117 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+/*
+Persistent worker pool for data parallel loops.
+The calling thread takes part in the work, so a pool of N workers runs N + 1 chunks at once.
+Jobs are not reentrant: do not call parallelFor from inside a job.
+*/
+class ThreadPool {
+
+public:
+
+	explicit ThreadPool(unsigned int workerCount = (std::max)(1u, std::thread::hardware_concurrency()) - 1) {
+		for (unsigned int i = 0; i < workerCount; i++)
+			workers.emplace_back([this]() { workerLoop(); });
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wakeUp.notify_all();
+		for (std::thread& t : workers) t.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	size_t size() const { return workers.size() + 1; }
+
+	/* fn(first, last) over [begin, end[ split in chunks of `grain` items, returns once every chunk is done */
+	void parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& fn) {
+
+		if (end <= begin) return;
+		grain = (std::max)(1, grain);
+		if (workers.empty() || end - begin <= grain) {
+			fn(begin, end);
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		job = &fn;
+		jobEnd = end;
+		jobGrain = grain;
+		next.store(begin);
+		busy = static_cast<int>(workers.size());
+		generation++;
+		lock.unlock();
+		wakeUp.notify_all();
+
+		runChunks();
+
+		lock.lock();
+		done.wait(lock, [this]() { return busy == 0; });
+		job = nullptr;
+	}
+
+private:
+
+	void runChunks() {
+		while (true) {
+			int first = next.fetch_add(jobGrain);
+			if (first >= jobEnd) return;
+			(*job)(first, (std::min)(first + jobGrain, jobEnd));
+		}
+	}
+
+	void workerLoop() {
+
+		unsigned long long seen = 0;
+
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeUp.wait(lock, [&]() { return stopping || generation != seen; });
+				if (stopping) return;
+				seen = generation;
+			}
+
+			runChunks();
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--busy == 0) done.notify_one();
+		}
+	}
+
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wakeUp, done;
+	bool stopping = false;
+	unsigned long long generation = 0;
+	int busy = 0;
+
+	const std::function<void(int, int)>* job = nullptr;
+	int jobEnd = 0, jobGrain = 1;
+	std::atomic<int> next{ 0 };
+
+};
+
+/* Shared pool sized to the machine */
+inline ThreadPool& defaultThreadPool() {
+	static ThreadPool pool;
+	return pool;
+}
+
+inline void parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& fn) {
+	defaultThreadPool().parallelFor(begin, end, grain, fn);
+}
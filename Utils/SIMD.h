@@ -0,0 +1,136 @@
+#pragma once
+
+#include <emmintrin.h>
+#include <cstdint>
+
+/*
+Thin SSE2 wrappers, 4 lanes.
+SSE2 is the baseline on every target of the solution so no dispatching is needed.
+Comparisons return lane masks (all bits set / cleared) meant for select() and any()/all().
+min / max are spelled vmin / vmax since <Windows.h> defines them as macros.
+*/
+namespace SIMD {
+
+	struct int4;
+
+	struct float4
+	{
+		__m128 v;
+
+		float4() : v(_mm_setzero_ps()) {}
+		float4(__m128 m) : v(m) {}
+		float4(float f) : v(_mm_set1_ps(f)) {}
+		float4(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d)) {}
+
+		static float4 load(const float* p) { return _mm_loadu_ps(p); }
+		void store(float* p) const { _mm_storeu_ps(p, v); }
+
+		/* start, start + step, start + 2 * step, start + 3 * step */
+		static float4 ramp(float start, float step) {
+			return _mm_add_ps(_mm_set1_ps(start), _mm_mul_ps(_mm_setr_ps(0.f, 1.f, 2.f, 3.f), _mm_set1_ps(step)));
+		}
+
+		float operator[](int i) const {
+			alignas(16) float f[4];
+			_mm_store_ps(f, v);
+			return f[i];
+		}
+	};
+
+	struct int4
+	{
+		__m128i v;
+
+		int4() : v(_mm_setzero_si128()) {}
+		int4(__m128i m) : v(m) {}
+		int4(int i) : v(_mm_set1_epi32(i)) {}
+
+		void store(int32_t* p) const { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+
+		int operator[](int i) const {
+			alignas(16) int32_t d[4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(d), v);
+			return d[i];
+		}
+	};
+
+	// -- float4
+
+	inline float4 operator+(float4 a, float4 b) { return _mm_add_ps(a.v, b.v); }
+	inline float4 operator-(float4 a, float4 b) { return _mm_sub_ps(a.v, b.v); }
+	inline float4 operator*(float4 a, float4 b) { return _mm_mul_ps(a.v, b.v); }
+	inline float4 operator/(float4 a, float4 b) { return _mm_div_ps(a.v, b.v); }
+	inline float4 operator-(float4 a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.f)); }
+
+	inline float4 operator<(float4 a, float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+	inline float4 operator>(float4 a, float4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+	inline float4 operator<=(float4 a, float4 b) { return _mm_cmple_ps(a.v, b.v); }
+	inline float4 operator>=(float4 a, float4 b) { return _mm_cmpge_ps(a.v, b.v); }
+
+	inline float4 operator&(float4 a, float4 b) { return _mm_and_ps(a.v, b.v); }
+	inline float4 operator|(float4 a, float4 b) { return _mm_or_ps(a.v, b.v); }
+	inline float4 operator^(float4 a, float4 b) { return _mm_xor_ps(a.v, b.v); }
+	inline float4 andNot(float4 mask, float4 a) { return _mm_andnot_ps(mask.v, a.v); }
+
+	inline float4 vmin(float4 a, float4 b) { return _mm_min_ps(a.v, b.v); }
+	inline float4 vmax(float4 a, float4 b) { return _mm_max_ps(a.v, b.v); }
+	inline float4 sqrt(float4 a) { return _mm_sqrt_ps(a.v); }
+	inline float4 abs(float4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a.v); }
+	inline float4 clamp(float4 a, float4 lo, float4 hi) { return vmin(vmax(a, lo), hi); }
+
+	/* mask ? a : b, lane wise */
+	inline float4 select(float4 mask, float4 a, float4 b) {
+		return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+	}
+
+	inline int movemask(float4 mask) { return _mm_movemask_ps(mask.v); }
+	inline bool any(float4 mask) { return movemask(mask) != 0; }
+	inline bool all(float4 mask) { return movemask(mask) == 0xF; }
+
+	// -- int4
+
+	inline int4 operator+(int4 a, int4 b) { return _mm_add_epi32(a.v, b.v); }
+	inline int4 operator-(int4 a, int4 b) { return _mm_sub_epi32(a.v, b.v); }
+	inline int4 operator&(int4 a, int4 b) { return _mm_and_si128(a.v, b.v); }
+	inline int4 operator|(int4 a, int4 b) { return _mm_or_si128(a.v, b.v); }
+	inline int4 operator^(int4 a, int4 b) { return _mm_xor_si128(a.v, b.v); }
+	inline int4 operator<<(int4 a, int n) { return _mm_slli_epi32(a.v, n); }
+	/* Logical shift, the lanes are treated as unsigned */
+	inline int4 operator>>(int4 a, int n) { return _mm_srli_epi32(a.v, n); }
+
+	/* Low 32 bits of the lane wise product, _mm_mullo_epi32 is SSE4.1 only */
+	inline int4 operator*(int4 a, int4 b) {
+		__m128i even = _mm_mul_epu32(a.v, b.v);
+		__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a.v, 32), _mm_srli_epi64(b.v, 32));
+		return _mm_unpacklo_epi32(
+			_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+			_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+	}
+
+	// -- conversions
+
+	inline float4 toFloat(int4 a) { return _mm_cvtepi32_ps(a.v); }
+	inline float4 asFloat(int4 a) { return _mm_castsi128_ps(a.v); }
+	inline int4 asInt(float4 a) { return _mm_castps_si128(a.v); }
+
+	/* Rounds towards -inf, cvttps truncates so negative non integers are corrected by one */
+	inline int4 floorToInt(float4 a) {
+		__m128i i = _mm_cvttps_epi32(a.v);
+		__m128 correction = _mm_cmpgt_ps(_mm_cvtepi32_ps(i), a.v);
+		return _mm_add_epi32(i, _mm_castps_si128(correction));
+	}
+
+	// -- 4 vectors at once, one per lane
+
+	struct vec3x4
+	{
+		float4 x, y, z;
+	};
+
+	inline vec3x4 operator+(const vec3x4& a, const vec3x4& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+	inline vec3x4 operator-(const vec3x4& a, const vec3x4& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+	inline vec3x4 operator*(const vec3x4& a, float4 s) { return { a.x * s, a.y * s, a.z * s }; }
+	inline float4 dot(const vec3x4& a, const vec3x4& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	inline float4 length(const vec3x4& a) { return sqrt(dot(a, a)); }
+
+}
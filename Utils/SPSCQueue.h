@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+
+/*
+Bounded lock-free single producer / single consumer ring buffer.
+
+Indices grow forever and are masked on access, so full and empty never get confused.
+Each side keeps a cached copy of the other index and only reloads the shared atomic when
+the cache says the queue looks full (producer) or empty (consumer).
+*/
+template<typename T, size_t Capacity>
+class SPSCQueue {
+
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+
+	/* Producer only, false when the queue is full */
+	bool push(const T& value) {
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if (head - cachedTail == Capacity) {
+			cachedTail = m_tail.load(std::memory_order_acquire);
+			if (head - cachedTail == Capacity) return false;
+		}
+		items[head & (Capacity - 1)] = value;
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* Consumer only, false when the queue is empty */
+	bool pop(T& out) {
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail == cachedHead) {
+			cachedHead = m_head.load(std::memory_order_acquire);
+			if (tail == cachedHead) return false;
+		}
+		out = items[tail & (Capacity - 1)];
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* Approximate when called while the other side is running */
+	size_t size() const {
+		return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+	}
+
+private:
+
+	// Producer side
+	alignas(64) std::atomic<size_t> m_head{ 0 };
+	size_t cachedTail = 0;
+
+	// Consumer side
+	alignas(64) std::atomic<size_t> m_tail{ 0 };
+	size_t cachedHead = 0;
+
+	alignas(64) std::array<T, Capacity> items{};
+
+};
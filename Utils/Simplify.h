@@ -0,0 +1,303 @@
+#pragma once
+
+#include "Math.h"
+#include "Vertex.h"
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <initializer_list>
+
+/*
+Quadric error metric mesh simplification (Garland & Heckbert 97).
+
+Edges are collapsed cheapest first until the triangle budget is met. Boundary edges get
+an extra perpendicular plane so open meshes (terrain chunks, meshes with split normals)
+keep their outline.
+
+The quadrics are weighted (by area, boundaries much more) and only decide the order and
+the placement. The reported error is measured apart: every vertex keeps the original planes
+it stands for, and a collapse costs the largest distance from its target to those planes.
+That is a length in the mesh units, so it scales with the mesh and compares with cells
+once multiplied by the cells per unit. Collapses above maxError are skipped.
+*/
+
+namespace Simplify {
+
+	/* Symmetric 4x4 matrix, only the upper triangle is stored */
+	struct Quadric
+	{
+		double a2 = 0, ab = 0, ac = 0, ad = 0;
+		double b2 = 0, bc = 0, bd = 0;
+		double c2 = 0, cd = 0;
+		double d2 = 0;
+
+		static Quadric fromPlane(double a, double b, double c, double d, double weight = 1.0) {
+			Quadric q;
+			q.a2 = a * a * weight; q.ab = a * b * weight; q.ac = a * c * weight; q.ad = a * d * weight;
+			q.b2 = b * b * weight; q.bc = b * c * weight; q.bd = b * d * weight;
+			q.c2 = c * c * weight; q.cd = c * d * weight;
+			q.d2 = d * d * weight;
+			return q;
+		}
+
+		Quadric& operator+=(const Quadric& o) {
+			a2 += o.a2; ab += o.ab; ac += o.ac; ad += o.ad;
+			b2 += o.b2; bc += o.bc; bd += o.bd;
+			c2 += o.c2; cd += o.cd;
+			d2 += o.d2;
+			return *this;
+		}
+
+		/* Sum of squared distances to the accumulated planes */
+		double error(double x, double y, double z) const {
+			return a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+				+ b2 * y * y + 2 * bc * y * z + 2 * bd * y
+				+ c2 * z * z + 2 * cd * z
+				+ d2;
+		}
+
+		/* Minimizer of the error, false when the system is singular */
+		bool optimal(double& x, double& y, double& z) const {
+			double det = a2 * (b2 * c2 - bc * bc) - ab * (ab * c2 - bc * ac) + ac * (ab * bc - b2 * ac);
+			if (std::abs(det) < 1e-12) return false;
+			double inv = 1.0 / det;
+			x = -inv * (ad * (b2 * c2 - bc * bc) - ab * (bd * c2 - bc * cd) + ac * (bd * bc - b2 * cd));
+			y = -inv * (a2 * (bd * c2 - cd * bc) - ad * (ab * c2 - bc * ac) + ac * (ab * cd - bd * ac));
+			z = -inv * (a2 * (b2 * cd - bc * bd) - ab * (ab * cd - bd * ac) + ad * (ab * bc - b2 * ac));
+			return true;
+		}
+	};
+
+	struct Result {
+		std::vector<Vertex> vertices;
+		std::vector<Index> indices;
+		float error = 0; // largest distance of a collapsed vertex to the original planes, in mesh units
+	};
+
+	inline Result simplify(const std::vector<Vertex>& vertices, const std::vector<Index>& indices,
+		size_t targetTriangles, float maxError = 1e30f)
+	{
+		using Vec3 = Math::Vec3<float>;
+
+		const size_t vertexCount = vertices.size();
+		const size_t triangleCount = indices.size() / 3;
+
+		std::vector<Vertex> verts = vertices;
+		std::vector<Index> tris(indices.begin(), indices.begin() + triangleCount * 3);
+		std::vector<bool> triAlive(triangleCount, true);
+		std::vector<bool> vertAlive(vertexCount, true);
+		std::vector<uint32_t> version(vertexCount, 0);
+		std::vector<Quadric> quadrics(vertexCount);
+		std::vector<std::vector<uint32_t>> vertTris(vertexCount);
+
+		// Unweighted planes for the error, per vertex the sorted ids of the planes it stands for
+		struct Plane { double a, b, c, d; };
+		std::vector<Plane> planes;
+		std::vector<std::vector<uint32_t>> vertPlanes(vertexCount);
+		auto addPlane = [&](double a, double b, double c, double d, std::initializer_list<Index> on) {
+			for (Index v : on) vertPlanes[v].push_back(static_cast<uint32_t>(planes.size()));
+			planes.push_back({ a, b, c, d });
+		};
+
+		auto faceNormal = [&](Index i0, Index i1, Index i2) {
+			Vec3 p0 = verts[i0].position, p1 = verts[i1].position, p2 = verts[i2].position;
+			return Math::cross(p1 - p0, p2 - p0);
+		};
+
+		// -- Quadrics from the face planes, weighted by area
+
+		for (uint32_t t = 0; t < triangleCount; t++) {
+			Index i0 = tris[t * 3], i1 = tris[t * 3 + 1], i2 = tris[t * 3 + 2];
+			Vec3 n = faceNormal(i0, i1, i2);
+			double len = n.length();
+			if (len > 0) {
+				double a = n.x / len, b = n.y / len, c = n.z / len;
+				double d = -(a * verts[i0].position.x + b * verts[i0].position.y + c * verts[i0].position.z);
+				Quadric q = Quadric::fromPlane(a, b, c, d, len * .5);
+				quadrics[i0] += q; quadrics[i1] += q; quadrics[i2] += q;
+				addPlane(a, b, c, d, { i0, i1, i2 });
+			}
+			vertTris[i0].push_back(t); vertTris[i1].push_back(t); vertTris[i2].push_back(t);
+		}
+
+		// -- Boundary constraints, an edge used by a single triangle is a border
+
+		struct Edge { Index a, b; uint32_t tri; };
+		std::vector<Edge> edges;
+		edges.reserve(triangleCount * 3);
+		for (uint32_t t = 0; t < triangleCount; t++) {
+			for (int k = 0; k < 3; k++) {
+				Index a = tris[t * 3 + k], b = tris[t * 3 + (k + 1) % 3];
+				edges.push_back({ (std::min)(a, b), (std::max)(a, b), t });
+			}
+		}
+		std::sort(edges.begin(), edges.end(), [](const Edge& l, const Edge& r) {
+			return (l.a != r.a) ? l.a < r.a : l.b < r.b;
+		});
+
+		for (size_t e = 0; e < edges.size();) {
+			size_t next = e + 1;
+			while (next < edges.size() && edges[next].a == edges[e].a && edges[next].b == edges[e].b) next++;
+			if (next - e == 1) {
+				const Edge& edge = edges[e];
+				const Index* t = &tris[edge.tri * 3];
+				Vec3 pa = verts[edge.a].position, pb = verts[edge.b].position;
+				Vec3 along = pb - pa;
+				Vec3 side = Math::cross(along, faceNormal(t[0], t[1], t[2]));
+				double len = side.length();
+				if (len > 0) {
+					double a = side.x / len, b = side.y / len, c = side.z / len;
+					double d = -(a * pa.x + b * pa.y + c * pa.z);
+					Quadric q = Quadric::fromPlane(a, b, c, d, 1000.0 * along.length() * along.length());
+					quadrics[edge.a] += q; quadrics[edge.b] += q;
+					addPlane(a, b, c, d, { edge.a, edge.b });
+				}
+			}
+			e = next;
+		}
+
+		// -- Collapse candidates
+
+		struct Candidate {
+			double cost;
+			Index a, b;
+			uint32_t versionA, versionB;
+			Vec3 target;
+			bool operator<(const Candidate& o) const { return cost > o.cost; } // min heap
+		};
+		std::priority_queue<Candidate> heap;
+
+		auto evaluate = [&](Index a, Index b) {
+			Quadric q = quadrics[a];
+			q += quadrics[b];
+			Vec3 pa = verts[a].position, pb = verts[b].position;
+			Vec3 mid = (pa + pb) * .5f;
+			double x, y, z;
+			Vec3 best = mid;
+			double cost = q.error(mid.x, mid.y, mid.z);
+			if (q.optimal(x, y, z)) {
+				double c = q.error(x, y, z);
+				if (c < cost) { cost = c; best = { (float)x, (float)y, (float)z }; }
+			}
+			for (const Vec3& p : { pa, pb }) {
+				double c = q.error(p.x, p.y, p.z);
+				if (c < cost) { cost = c; best = p; }
+			}
+			heap.push({ (std::max)(cost, 0.0), a, b, version[a], version[b], best });
+		};
+
+		for (size_t e = 0; e < edges.size(); e++) {
+			if (e > 0 && edges[e].a == edges[e - 1].a && edges[e].b == edges[e - 1].b) continue;
+			evaluate(edges[e].a, edges[e].b);
+		}
+
+		// Rejects collapses that would fold a surviving triangle over
+		auto flips = [&](Index from, Index other, Vec3 target) {
+			for (uint32_t t : vertTris[from]) {
+				if (!triAlive[t]) continue;
+				Index* tri = &tris[t * 3];
+				if (tri[0] == other || tri[1] == other || tri[2] == other) continue;
+				Vec3 before = faceNormal(tri[0], tri[1], tri[2]);
+				Vec3 saved = verts[from].position;
+				verts[from].position = target;
+				Vec3 after = faceNormal(tri[0], tri[1], tri[2]);
+				verts[from].position = saved;
+				if (Math::dot(before, after) <= 0) return true;
+			}
+			return false;
+		};
+
+		// Distance of the merged vertex to the surface the two endpoints stood for
+		auto deviation = [&](Index a, Index b, Vec3 target) {
+			double worst = 0;
+			for (Index v : { a, b })
+				for (uint32_t id : vertPlanes[v]) {
+					const Plane& p = planes[id];
+					worst = (std::max)(worst, std::abs(p.a * target.x + p.b * target.y + p.c * target.z + p.d));
+				}
+			return worst;
+		};
+
+		size_t aliveTriangles = triangleCount;
+		double maxDistance = 0;
+		std::vector<uint32_t> merged;
+
+		while (aliveTriangles > targetTriangles && !heap.empty()) {
+
+			Candidate c = heap.top();
+			heap.pop();
+
+			// Only the merged vertex changes, so an entry is stale once either endpoint was merged into
+			if (!vertAlive[c.a] || !vertAlive[c.b]) continue;
+			if (version[c.a] != c.versionA || version[c.b] != c.versionB) continue;
+			if (flips(c.a, c.b, c.target) || flips(c.b, c.a, c.target)) continue;
+			double distance = deviation(c.a, c.b, c.target);
+			if (distance > maxError) continue;
+
+			// Collapse b into a
+			Vertex& va = verts[c.a];
+			Vec3 n = va.normal + verts[c.b].normal;
+			va.position = c.target;
+			va.normal = (n.length() > 0) ? n.normalize() : va.normal;
+			quadrics[c.a] += quadrics[c.b];
+			vertAlive[c.b] = false;
+			version[c.a]++;
+			maxDistance = (std::max)(maxDistance, distance);
+
+			merged.clear();
+			std::set_union(vertPlanes[c.a].begin(), vertPlanes[c.a].end(),
+				vertPlanes[c.b].begin(), vertPlanes[c.b].end(), std::back_inserter(merged));
+			vertPlanes[c.a].swap(merged);
+			std::vector<uint32_t>().swap(vertPlanes[c.b]);
+
+			for (uint32_t t : vertTris[c.b]) {
+				if (!triAlive[t]) continue;
+				Index* tri = &tris[t * 3];
+				bool hasA = tri[0] == c.a || tri[1] == c.a || tri[2] == c.a;
+				if (hasA) {
+					triAlive[t] = false;
+					aliveTriangles--;
+					continue;
+				}
+				for (int k = 0; k < 3; k++) if (tri[k] == c.b) tri[k] = c.a;
+				vertTris[c.a].push_back(t);
+			}
+			vertTris[c.b].clear();
+
+			// Re-evaluate the edges around the merged vertex
+			auto& around = vertTris[c.a];
+			around.erase(std::remove_if(around.begin(), around.end(), [&](uint32_t t) { return !triAlive[t]; }), around.end());
+			std::vector<Index> neighbours;
+			for (uint32_t t : around)
+				for (int k = 0; k < 3; k++)
+					if (tris[t * 3 + k] != c.a) neighbours.push_back(tris[t * 3 + k]);
+			std::sort(neighbours.begin(), neighbours.end());
+			neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+			for (Index nb : neighbours)
+				evaluate((std::min)(c.a, nb), (std::max)(c.a, nb));
+		}
+
+		// -- Compact
+
+		Result result;
+		std::vector<Index> remap(vertexCount, static_cast<Index>(-1));
+		for (uint32_t t = 0; t < triangleCount; t++) {
+			if (!triAlive[t]) continue;
+			for (int k = 0; k < 3; k++) {
+				Index v = tris[t * 3 + k];
+				if (remap[v] == static_cast<Index>(-1)) {
+					remap[v] = static_cast<Index>(result.vertices.size());
+					result.vertices.push_back(verts[v]);
+				}
+				result.indices.push_back(remap[v]);
+			}
+		}
+		result.error = static_cast<float>(maxDistance);
+		return result;
+	}
+
+}
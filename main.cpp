@@ -1,5 +1,7 @@
 #include <iostream>
 
+#include "Renderer/FrameServer.h" // first, winsock2.h has to come before Windows.h
+
 #include "Utils/Math.h"
 #include "Utils/FPSCounter.h"
 
@@ -7,6 +9,15 @@
 #include "Renderer/Shapes.h"
 #include "Renderer/Console.h"
 #include "Renderer/Camera.h"
+#include "Renderer/Deferred.h"
+#include "Renderer/Terrain.h"
+#include "Renderer/LOD.h"
+#include "Renderer/Scene.h"
+#include "Renderer/SDF.h"
+#include "Renderer/Input.h"
+#include "Renderer/Particles.h"
+#include "Renderer/DirtyTiles.h"
+#include "Renderer/Viewport.h"
 
 
 #include <algorithm>
@@ -15,6 +26,8 @@
 #include <array>
 #include <vector>
 #include <thread>
+#include <random>
+#include <optional>
 
 
 int main() {
@@ -28,12 +41,28 @@ int main() {
 	constexpr int height = SCREEN_WIDTH;
 
 	bool COLORS_MODE = true;
+	bool DEFERRED_MODE = false;
+	bool TERRAIN_MODE = false;
+	bool SDF_MODE = false; // ray marched, always goes through the deferred resolve
+	bool PARTICLES_MODE = false; // point splatted fountain drawn over the scene
+	bool SERVER_MODE = false; // also streams every frame to the terminals connected on port 7777
+	bool VIEWPORTS_MODE = false; // orbit, top, side and front views of the scene in a 2x2 split screen
+	RENDER_MODE SCENE_MODE = RENDER_MODE::FILLED; // 'm' cycles it, the line modes always go through the forward path
 	int framebufferSize = (COLORS_MODE) ? width * height * 8: width * height;
 
 	Console::changeZoom(2,2);
 	Console::setTerminalScreenResolution(width, height);
 
 	char *buff = new char[framebufferSize];
+	GBuffer gbuffer(width, height);
+
+	std::vector<Light> lights = {
+		{ { 7, 9, 5 }, 1.f },				// sun
+		{ { -5, 2, -3 }, 0.3f },			// fill
+	};
+	std::vector<Material> materials = {
+		{ COLOR::white, COLOR::green, 0.05f, 0.9f, 0.4f, 16.f },
+	};
 
 	OrthographicCamera camera;
 	FPSCounter fps;
@@ -46,28 +75,195 @@ int main() {
 	std::vector<Index> i = cube.indices;
 	std::transform(i.begin(), i.end(), i.begin(), [](Index i) {return i - 1; });
 
+	Scene scene;
+	scene.add(std::make_shared<Mesh>(buildLODChain(v, i)));
+	scene.update();
+
+	SDFScene sdf;
+	int sdfBall = sdf.translate(sdf.sphere(.6f), { .4f, 0, 0 });
+	int sdfSpin = sdf.rotateY(sdf.box({ .4f, .4f, .4f }), 0.f);
+	int sdfBlob = sdf.smoothUnion(sdfBall, sdfSpin, .3f);
+	int sdfRing = sdf.translate(sdf.torus(.5f, .12f), { -.2f, -.6f, 0 });
+	int sdfFloor = sdf.plane({ 0, 1, 0 }, 1.f);
+	sdf.unite(sdf.unite(sdfBlob, sdfRing), sdfFloor);
+	float sdfTime = 0.f; // seconds since start, the clock itself is too large for a float angle
+
+	ParticleSystem particles(100000);
+	ParticleSettings particleSettings;
+	particleSettings.floor = -1.f;
+	std::mt19937 rng;
+	std::uniform_real_distribution<float> spread(-1.f, 1.f);
+
+	std::optional<Terrain> terrain; // only built in terrain mode, it owns the chunk worker threads
+	float flySpeed = 2.f;
+	if (TERRAIN_MODE) {
+		terrain.emplace();
+		camera.setScale(6);
+	}
+
 	std::ios::sync_with_stdio(false); // increase output stream speed
 
-	while (true) {
+	InputThread input;
+	InputLatency latency;
+	bool autoOrbit = true;
+	int picked = -1;
+	bool running = true;
+	input.start();
+
+	FrameServer server;
+	if (SERVER_MODE && !server.start()) SERVER_MODE = false;
 
+	DirtyTiles dirtyTiles;
+
+	// The orbit view follows `camera`, the others are fixed
+	std::vector<Viewport> viewports;
+	ViewportCache viewportCache;
+	if (VIEWPORTS_MODE) {
+		std::vector<ScreenRect> rects = splitScreen(2, 2);
+		Math::Vec3<float> eyes[] = { { 0, 5, .5f }, { 5, 0, 0 }, { 0, 0, 5 } };
+		camera.setScale(25);
+		for (int n = 0; n < 4; n++) {
+			Viewport viewport;
+			viewport.rect = rects[n];
+			viewport.camera.setScale(25);
+			if (n > 0) {
+				viewport.camera.setPosition(eyes[n - 1]);
+				viewport.camera.updateCam(0, false);
+			}
+			viewports.push_back(viewport);
+		}
+	}
+
+	while (running) {
+
+
+		// -- Input, drained without blocking
+
+		InputEvent event;
+		while (input.poll(event)) {
+			latency.consumed(event);
+			switch (event.type) {
+			case INPUT_EVENT::KEY:
+				switch (event.key) {
+				case KEY::LEFT: camera.orbit(-.1f); break;
+				case KEY::RIGHT: camera.orbit(.1f); break;
+				case KEY::UP: camera.setScale(camera.getScale() * 1.1f); break;
+				case KEY::DOWN: camera.setScale(camera.getScale() / 1.1f); break;
+				case ' ': autoOrbit = !autoOrbit; break;
+				case 'm': SCENE_MODE = static_cast<RENDER_MODE>((static_cast<int>(SCENE_MODE) + 1) % 4); break;
+				case 'q': case KEY::ESCAPE: running = false; break;
+				}
+				break;
+			case INPUT_EVENT::WHEEL:
+				camera.setScale((event.button > 0) ? camera.getScale() * 1.1f : camera.getScale() / 1.1f);
+				break;
+			case INPUT_EVENT::MOUSE_DOWN:
+				// Picks against the camera of the frame the click was made on
+				if (event.button == 0 && !VIEWPORTS_MODE) picked = scene.pick(camera, event.x, event.y);
+				if (event.button == 0 && VIEWPORTS_MODE) {
+					int n = viewportAt(viewports, event.x, event.y);
+					picked = (n < 0) ? -1 : scene.pick(viewports[n].centered(), event.x, event.y);
+				}
+				break;
+			default:
+				break;
+			}
+		}
 
 		// -- Update
 
 		fps.step();
-		camera.updateCam(fps.elapsed);
-		Console::setTitle("FPS:" + std::to_string(fps.FPS));
+		if (TERRAIN_MODE) {
+			Math::Vec3<float> target = camera.getTarget();
+			target.x += flySpeed * static_cast<float>(fps.elapsed);
+			camera.setTarget(target);
+			terrain->update(target);
+		}
+		camera.updateCam(autoOrbit ? static_cast<float>(fps.elapsed) : 0.f);
+		if (SDF_MODE) {
+			sdfTime += static_cast<float>(fps.elapsed);
+			sdf.setRotation(sdfSpin, sdfTime);
+		}
+		if (PARTICLES_MODE) {
+			float dt = (std::min)(static_cast<float>(fps.elapsed), 0.1f);
+			for (int n = static_cast<int>(20000 * dt); n > 0; n--)
+				particles.spawn({ 0, 1, 0 }, { spread(rng) * 1.5f, 6.f + spread(rng), spread(rng) * 1.5f }, 3.f);
+			particles.update(dt, particleSettings);
+		}
+		Console::setTitle("FPS:" + std::to_string(fps.FPS)
+			+ " input latency ms:" + std::to_string(static_cast<int>(latency.lastMs))
+			+ " avg:" + std::to_string(static_cast<int>(latency.averageMs))
+			+ " max:" + std::to_string(static_cast<int>(latency.maxMs))
+			+ " picked:" + std::to_string(picked)
+			+ (SERVER_MODE ? " viewers:" + std::to_string(server.clientCount()) : ""));
 
 		// -- Render
 
-		clearScreenBuffer(buff, COLORS_MODE);
-		clearDepth();
-		
-		renderMesh(buff, camera, v, i);
+		// The scene alone can be redrawn in pieces, the other modes change every frame
+		bool incremental = !SDF_MODE && !TERRAIN_MODE && !PARTICLES_MODE && !VIEWPORTS_MODE;
+		bool deferred = DEFERRED_MODE && SCENE_MODE == RENDER_MODE::FILLED;
+
+		if (VIEWPORTS_MODE) {
+			// Forward path only, the shared work is done once for the four cameras
+			viewports[0].camera = camera;
+			for (Viewport& viewport : viewports) viewport.mode = SCENE_MODE;
+			viewportCache.build(scene, viewports);
+			viewportCache.render(buff, viewports, COLORS_MODE);
+			resetCursor();
+		}
+		else if (incremental) {
+			if (!dirtyTiles.update(camera, scene, { SCENE_MODE, deferred, COLORS_MODE })) {
+				// The previous frame is still on screen, nothing to draw or present
+				latency.skip();
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				continue;
+			}
+			dirtyTiles.forEachDirtyRect([&](ScreenRect rect) {
+				clearScreenRect(buff, rect, COLORS_MODE);
+				if (deferred) {
+					gbuffer.clear(rect);
+					scene.renderDeferred(gbuffer, camera, rect);
+					resolveDeferred(buff, gbuffer, camera, lights, materials, COLORS_MODE, rect);
+				}
+				else {
+					dp.clear(rect.x0, rect.y0, rect.x1, rect.y1);
+					scene.render(buff, camera, SCENE_MODE, rect);
+				}
+			});
+			resetCursor();
+		}
+		else if (deferred || SDF_MODE) {
+			clearScreenBuffer(buff, COLORS_MODE);
+			gbuffer.clear();
+			if (SDF_MODE)
+				renderSDF(gbuffer, camera, sdf);
+			else if (TERRAIN_MODE)
+				for (const Terrain::VisibleChunk& chunk : terrain->visible())
+					renderMeshDeferred(gbuffer, camera, chunk.mesh().vertices, chunk.mesh().indices, 0);
+			else
+				scene.renderDeferred(gbuffer, camera);
+			resolveDeferred(buff, gbuffer, camera, lights, materials, COLORS_MODE);
+			if (PARTICLES_MODE) renderParticles(buff, camera, particles, gbuffer.getDepth(), {}, COLORS_MODE);
+		}
+		else {
+			clearScreenBuffer(buff, COLORS_MODE);
+			clearDepth();
+			if (TERRAIN_MODE)
+				for (const Terrain::VisibleChunk& chunk : terrain->visible())
+					renderMesh(buff, camera, chunk.mesh().vertices, chunk.mesh().indices, SCENE_MODE, &chunk.mesh().edges);
+			else
+				scene.render(buff, camera, SCENE_MODE);
+			if (PARTICLES_MODE) renderParticles(buff, camera, particles, dp, {}, COLORS_MODE);
+		}
 
 		preventResize(buff);
 		renderBuffer(buff, framebufferSize);
+		latency.presented();
+		if (SERVER_MODE) server.publish(buff, framebufferSize, COLORS_MODE);
 
 	}
+
+	input.stop();
 	
 	system("pause");
 	return 0;